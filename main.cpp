@@ -1,93 +1,241 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <cerrno>
+#include <cctype>
+#include <limits>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "sequitur.hpp"
 
 //
 // This file just executes some random actions using my sequitur implementation, to help give you a feel for how it works.
 //
+// Usage: sequitur [options] path...
+//
+// Each path is a file, or a directory to look through for files. Given a single file, its rules are printed
+// along with some stats. Given more, files are shared out between N worker threads (one per core by default),
+// each with its own Sequitur, and a line of stats is printed per file as it finishes.
+//
+// Options:
+//   --repair            build grammars offline with Re-Pair rather than Sequitur
+//   --threads N         number of worker threads for many files
+//   --no-verify         don't check each grammar gives back its file
+//   --progress SECONDS  how often to report progress to stderr (0 for never; 1 by default)
+//   --quiet             print no rules, per-file lines or progress; just errors (and --stats)
+//   --stats             finish with a one line JSON summary: input size, time, MB/s, rules, symbols
+//                       and peak memory
+//   --latency           add values one push_back() at a time, timing each, and report percentiles
+//                       of those times (and of digram index growth) in the stats
+//   --max-depth N       don't let Sequitur nest rules more than N deep (0, the default, for no limit);
+//                       Re-Pair has no such limit, so this can't be used with --repair
+//
 
 using namespace std;
 //my namespace gives access to sequitur and related:
 using namespace jw;
 
+//what was asked for at the console:
+struct Options
+    {
+    bool use_repair = false;
+    bool verify = true;
+    bool quiet = false;
+    bool stats = false;
+    bool latency = false;
+    unsigned max_depth = 0;
+    double progress_seconds = 1;
+    unsigned threads = thread::hardware_concurrency();
+    };
 
-int main(int argc, char* argv[])
+//what we found out about each file:
+struct FileStats
     {
-    //
-    // Look at the first string passed in at the console, and treat it as a file path, opening said file:
-    //
-    if(argc != 2) cerr << "Need one argument (filename)" << endl;
-    string filename = argv[1];
+    string filename;
+    bool ok = false;
+    unsigned long long bytes = 0;
+    unsigned rules = 0;
+    unsigned long long symbols = 0;
+    double seconds = 0;
+    //with --latency, how long each push_back() and digram index growth took:
+    LatencyHistogram pushes;
+    LatencyHistogram index_growth;
+    };
 
-    ifstream input(filename, std::ios::binary);
+static double megabytesPerSecond(unsigned long long bytes, double seconds)
+    {
+    return seconds > 0? bytes / seconds / 1e6 : 0;
+    }
+
+static double secondsSince(chrono::steady_clock::time_point start)
+    {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+//read a whole argument as a number, returning false if it isn't one:
+static bool parseUnsigned(const char * text, unsigned & out)
+    {
+    char * end;
+    errno = 0;
+    unsigned long value = strtoul(text, &end, 10);
+    if(!isdigit((unsigned char)*text) || *end || errno || value > numeric_limits<unsigned>::max()) return false;
+    out = value;
+    return true;
+    }
+static bool parseSeconds(const char * text, double & out)
+    {
+    char * end;
+    double value = strtod(text, &end);
+    if(end == text || *end || !(value >= 0)) return false;
+    out = value;
+    return true;
+    }
+
+//add path to files, or every file below it if it's a directory:
+static bool collectFiles(const string & path, vector<string> & files)
+    {
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0)
+        {
+        cerr << "File \"" << path << "\" not found." << endl;
+        return false;
+        }
+    if(!S_ISDIR(info.st_mode))
+        {
+        files.push_back(path);
+        return true;
+        }
+
+    DIR * dir = opendir(path.c_str());
+    if(!dir)
+        {
+        cerr << "Can't open directory \"" << path << "\"." << endl;
+        return false;
+        }
+    bool ok = true;
+    while(dirent * entry = readdir(dir))
+        {
+        string name = entry->d_name;
+        if(name == "." || name == "..") continue;
+        ok = collectFiles(path + "/" + name, files) && ok;
+        }
+    closedir(dir);
+    return ok;
+    }
+
+//
+// build a grammar for one file in s (or r, with Re-Pair), check it gives back the file, and count what's in it:
+//
+static FileStats processFile(const string & filename, Sequitur<char> & s, RePair<char> & r, const Options & options, bool progress)
+    {
+    FileStats stats;
+    stats.filename = filename;
 
+    ifstream input(filename, std::ios::binary);
     if(!input.is_open())
         {
         cerr << "File \"" << filename << "\" not found." << endl;
-        return 1;
+        return stats;
         }
-
     //
-    // Make a new Sequitur for taking in the char type:
+    // reset() hands back what the last file used, keeping hold of memory for this one:
+    //
+    auto build_start = chrono::steady_clock::now();
+    auto last_report = build_start;
+    s.reset();
+    s.setMaxRuleDepth(options.max_depth);
+    LatencyTrace trace;
+    bool traced = options.latency && !options.use_repair;
+    if(traced) s.traceLatency(&trace);
     //
-    Sequitur<char> s;
-    char temp_char;
-    unsigned count = 0;
-    while(input.get(temp_char))
+    // read the file a chunk at a time, and add each to Sequitur: pushRange() is like calling the familiar
+    // push_back() on each char, but picks out long runs of the same char to add in one go. RePair takes the
+    // same push_back() calls, but only builds once it has everything:
+    //
+    const size_t chunk_size = 1 << 16;
+    vector<char> chunk(chunk_size);
+    unsigned long long bytes = 0;
+    while(input.read(chunk.data(), chunk_size) || input.gcount())
         {
+        auto first = chunk.begin();
+        auto last = chunk.begin() + input.gcount();
+        if(options.use_repair) for(auto c = first; c != last; ++c) r.push_back(*c);
+        else if(traced) for(auto c = first; c != last; ++c) s.push_back(*c);
+        else s.pushRange(first, last);
+        bytes += last - first;
         //
-        //add chars to Sequitur, using the familiar push_back syntax:
-        //
-        s.push_back(temp_char);
-        //
-        //record the count and print an output every 100,000 chars:
+        //every so often, report how far we've got:
         //
-        count++;
-        if(count % 100000 == 0) cout << count << endl;
+        if(progress && secondsSince(last_report) >= options.progress_seconds)
+            {
+            cerr << bytes << " chars, " << megabytesPerSecond(bytes, secondsSince(build_start)) << "MB/s" << endl;
+            last_report = chrono::steady_clock::now();
+            }
         }
-    //clear the input flags and seek back to the beginning, so we can read it in again:
-    input.clear();
-    input.seekg(0);
-
     //
-    //we can't copy sequitur, but we can move it using the C++11 std::move function.
-    //This will move 's' to 's2', invalidating s:
+    // build() hands back a Sequitur, so everything below works the same for either:
     //
-    Sequitur<char> s2(std::move(s));
+    if(options.use_repair) s = r.build();
+    stats.seconds = secondsSince(build_start);
+    if(traced)
+        {
+        s.traceLatency(nullptr);
+        stats.pushes = trace.pushes;
+        stats.index_growth = trace.index_growth;
+        }
+    stats.bytes = bytes;
+
+    if(s.size() != bytes)
+        {
+        cerr << filename << ": holds " << s.size() << " chars, file has " << bytes << endl;
+        return stats;
+        }
+    stats.ok = true;
 
     //
-    //create a sequitur<char>::const_iter pointed to beginning char in s2:
+    //clear the input flags and seek back to the beginning, so we can read it in again, then create a
+    //sequitur<char>::const_iter pointed to beginning char in s, and compare each char with that which
+    //is stored in the sequitur container:
     //
-    auto seq_iter = s2.begin();
-
-    //read through the file again, and compare each char with that which is stored in the sequitur container s2:
-    count = 0;
-    while(input.get(temp_char))
+    if(options.verify)
         {
-        if(temp_char != *seq_iter)
+        input.clear();
+        input.seekg(0);
+        auto seq_iter = s.begin();
+        unsigned long long count = 0;
+        while(stats.ok && (input.read(chunk.data(), chunk_size) || input.gcount()))
             {
-            cerr << "not equal at " << count << ", file: " << temp_char << " seq: " << *seq_iter << endl;
+            for(streamsize i = 0; i < input.gcount(); ++i, ++count, ++seq_iter)
+                {
+                if(chunk[i] != *seq_iter)
+                    {
+                    cerr << filename << ": not equal at " << count << ", file: " << chunk[i] << " seq: " << *seq_iter << endl;
+                    stats.ok = false;
+                    break;
+                    }
+                }
+            }
+        if(stats.ok && count != bytes)
+            {
+            cerr << filename << ": changed while being read" << endl;
+            stats.ok = false;
             }
-        //
-        // we can post or pre-increment the iterator to look at the next char:
-        //
-        ++seq_iter;
-        ++count;
         }
 
-    //### lets see some stats: ###
-
     //
-    // get the rule table (of type std::unordered_map<Symbol*>):
+    // get the rule table (of type RuleIndex, which iterates over <ID, Symbol*> pairs):
     //
-    auto rule_table = s2.getRules();
-    auto it = rule_table.begin();
-    unsigned symbol_total = 0;
-    unsigned rule_count = 0;
-    while(it != rule_table.end())
+    for(const auto & rule_pair : s.getRules())
         {
-        ++rule_count;
+        ++stats.rules;
         //
         // consult baselist.hpp for list traversal commands given symbols.
         // consult symbols.hpp for the different symbol types and functions available on each
@@ -100,22 +248,182 @@ int main(int argc, char* argv[])
         // Symbol::end()/begin() returns a pair<[final_symbol], distance>
         //
         // Here, we count how many hops it takes to get to the end. This will get us one less than
-        // the total number of symbols. Since two of the symbols are RuleHead and RuleTail, we 
+        // the total number of symbols. Since two of the symbols are RuleHead and RuleTail, we
         // minus another one to get the number of symbols used in the rule.
         //
-        symbol_total += it->second->end().second - 1;
-        ++it;
+        stats.symbols += rule_pair.second->end().second - 1;
+        }
+
+    return stats;
+    }
+
+//
+// one line of JSON summing up the whole run, for scripts to pick up:
+//
+static void printStats(const vector<FileStats> & results, double seconds, const Options & options)
+    {
+    unsigned long long bytes = 0, symbols = 0, rules = 0;
+    unsigned files = 0;
+    double build_seconds = 0;
+    LatencyHistogram pushes, index_growth;
+    for(const FileStats & stats : results)
+        {
+        if(!stats.ok) continue;
+        ++files;
+        bytes += stats.bytes;
+        rules += stats.rules;
+        symbols += stats.symbols;
+        build_seconds += stats.seconds;
+        pushes.merge(stats.pushes);
+        index_growth.merge(stats.index_growth);
+        }
+
+    //ru_maxrss is in kilobytes on Linux:
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    cout << "{\"files\":" << files << ",\"failed\":" << results.size() - files
+         << ",\"bytes\":" << bytes << ",\"seconds\":" << seconds << ",\"build_seconds\":" << build_seconds
+         << ",\"mb_per_s\":" << megabytesPerSecond(bytes, seconds)
+         << ",\"rules\":" << rules << ",\"symbols\":" << symbols
+         << ",\"peak_rss_kb\":" << usage.ru_maxrss;
+    if(options.latency)
+        {
+        cout << ",\"push_ns\":{\"p50\":" << pushes.percentile(50) << ",\"p99\":" << pushes.percentile(99)
+             << ",\"p99.9\":" << pushes.percentile(99.9) << ",\"max\":" << pushes.max() << "}"
+             << ",\"index_growths\":" << index_growth.count() << ",\"index_growth_max_ns\":" << index_growth.max();
         }
+    cout << "}" << endl;
+    }
 
+int main(int argc, char* argv[])
+    {
     //
-    // a few print commands are included to quikly visualise the rules created:
+    // Look at the arguments passed in at the console: options first, then paths to files or directories:
     //
-    s2.printRules();
+    Options options;
+    vector<string> paths;
+    bool bad_arguments = false;
+    for(int i = 1; i < argc; ++i)
+        {
+        string arg = argv[i];
+        if(arg == "--repair") options.use_repair = true;
+        else if(arg == "--no-verify") options.verify = false;
+        else if(arg == "--quiet") options.quiet = true;
+        else if(arg == "--stats") options.stats = true;
+        else if(arg == "--latency") options.latency = true;
+        else if(arg == "--threads" && i+1 < argc) bad_arguments = !parseUnsigned(argv[++i], options.threads) || bad_arguments;
+        else if(arg == "--max-depth" && i+1 < argc) bad_arguments = !parseUnsigned(argv[++i], options.max_depth) || bad_arguments;
+        else if(arg == "--progress" && i+1 < argc) bad_arguments = !parseSeconds(argv[++i], options.progress_seconds) || bad_arguments;
+        else if(arg.compare(0, 2, "--") == 0) bad_arguments = true;
+        else paths.push_back(arg);
+        }
+    if(paths.empty() || bad_arguments)
+        {
+        cerr << "Usage: " << argv[0] << " [--repair] [--threads N] [--no-verify] [--progress SECONDS] [--quiet] [--stats] [--latency] [--max-depth N] path..." << endl;
+        return 1;
+        }
+    if(options.use_repair && options.max_depth)
+        {
+        cerr << "--max-depth only applies to Sequitur, and can't be used with --repair." << endl;
+        return 1;
+        }
+    bool progress = !options.quiet && options.progress_seconds > 0;
+    auto run_start = chrono::steady_clock::now();
 
-    cout << "total symbols inserted: " << count << endl;
-    cout << "symbols used in sequitur: " << symbol_total << endl;
-    cout << "rules created: " << rule_count << endl;
+    vector<string> files;
+    bool ok = true;
+    for(const string & path : paths) ok = collectFiles(path, files) && ok;
+    if(files.empty()) return 1;
+    unsigned threads = options.threads? options.threads : 1;
+    if(threads > files.size()) threads = files.size();
+    vector<FileStats> results(files.size());
 
-    return 0;
-}
+    //
+    // A single file gets progress as it goes, and its rules printed:
+    //
+    if(files.size() == 1)
+        {
+        //
+        // Make a new Sequitur for taking in the char type (and a RePair in case that was asked for):
+        //
+        Sequitur<char> s;
+        RePair<char> r;
+        FileStats & stats = results[0] = processFile(files[0], s, r, options, progress);
+
+        if(stats.ok && !options.quiet)
+            {
+            //
+            // a few print commands are included to quikly visualise the rules created:
+            //
+            s.printRules();
+
+            cout << "total symbols inserted: " << stats.bytes << endl;
+            cout << "symbols used in sequitur: " << stats.symbols << endl;
+            cout << "rules created: " << stats.rules << endl;
+            cout << "built by " << (options.use_repair? "Re-Pair" : "Sequitur") << " in " << (unsigned long long)(stats.seconds * 1000) << "ms" << endl;
+            if(stats.pushes.count())
+                {
+                cout << "push_back took p50 " << stats.pushes.percentile(50) << "ns, p99 " << stats.pushes.percentile(99)
+                     << "ns, p99.9 " << stats.pushes.percentile(99.9) << "ns, max " << stats.pushes.max() << "ns" << endl;
+                }
+            }
+        if(options.stats) printStats(results, secondsSince(run_start), options);
+        return (ok && stats.ok)? 0 : 1;
+        }
 
+    //
+    // Otherwise, each worker takes the next file nobody has started on until there are none left. Every
+    // worker has its own Sequitur; they share nothing else (symbol pools are per thread, too):
+    //
+    atomic<size_t> next_file(0);
+    mutex output_mutex;
+    unsigned long long total_bytes = 0;
+    unsigned done = 0, failed = 0;
+    auto batch_start = chrono::steady_clock::now();
+    auto last_report = batch_start;
+
+    auto worker = [&]()
+        {
+        Sequitur<char> s;
+        RePair<char> r;
+        size_t index;
+        while((index = next_file++) < files.size())
+            {
+            FileStats stats = processFile(files[index], s, r, options, false);
+
+            lock_guard<mutex> lock(output_mutex);
+            results[index] = stats;
+            ++done;
+            if(progress && secondsSince(last_report) >= options.progress_seconds)
+                {
+                cerr << done << "/" << files.size() << " files" << endl;
+                last_report = chrono::steady_clock::now();
+                }
+            if(!stats.ok)
+                {
+                ++failed;
+                continue;
+                }
+            total_bytes += stats.bytes;
+            if(options.quiet) continue;
+            cout << stats.filename << ": " << stats.bytes << " bytes, "
+                 << stats.rules << " rules, " << stats.symbols << " symbols, "
+                 << stats.seconds * 1000 << "ms, " << megabytesPerSecond(stats.bytes, stats.seconds) << "MB/s\n";
+            }
+        };
+
+    vector<thread> workers;
+    for(unsigned i = 0; i < threads; ++i) workers.emplace_back(worker);
+    for(thread & t : workers) t.join();
+
+    double seconds = secondsSince(batch_start);
+    if(!options.quiet)
+        {
+        cout << files.size() - failed << " files, " << total_bytes << " bytes in " << seconds * 1000 << "ms on "
+             << threads << " threads, " << megabytesPerSecond(total_bytes, seconds) << "MB/s" << endl;
+        }
+    if(options.stats) printStats(results, secondsSince(run_start), options);
+
+    return (ok && !failed)? 0 : 1;
+}
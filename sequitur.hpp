@@ -2,15 +2,23 @@
 #define SEQUITUR_H
 
 #include <unordered_map>
+#include <stdexcept>
 #include <cassert>
 #include <list>
 #include <tuple>
 #include <stack>
 #include <memory>
+#include <vector>
+#include <string>
+#include <iterator>
 #include "sequitur/symbols.hpp"
 #include "sequitur/symbolwrapper.hpp"
 #include "sequitur/hashing.hpp"
 #include "sequitur/id.hpp"
+#include "sequitur/ruleindex.hpp"
+#include "sequitur/digramindex.hpp"
+#include "sequitur/prescan.hpp"
+#include "sequitur/observer.hpp"
 
 namespace jw
     {
@@ -20,7 +28,23 @@ namespace jw
     //declare iter class before sequitur:
     template<typename Type> class SequiturIter;
 
-    template<typename Type>
+    //read only copy of a grammar (see sequitur/frozengrammar.hpp):
+    template<typename Type> class FrozenGrammar;
+
+    //rules to prime new grammars with (see sequitur/dictionary.hpp):
+    template<typename Type> class Dictionary;
+
+    //offline grammar builder, handing back a Sequitur (see sequitur/repair.hpp):
+    template<typename Type> class RePair;
+
+    //buffered sink for writing grammars out (see sequitur/exporter.hpp):
+    class OutputBuffer;
+
+    //latency histograms and slow call hook (see sequitur/latency.hpp):
+    class LatencyTrace;
+
+    //Observer is told as rules come and go (see sequitur/observer.hpp):
+    template<typename Type, typename Observer = NoObserver>
     class Sequitur
         {
         //### iterator classes ###
@@ -31,7 +55,7 @@ namespace jw
             using value_type = Type;
             using const_value_type = const Type;
 
-            SequiturIter(const Sequitur<Type> * in_parent): parent(in_parent) {}
+            SequiturIter(const Sequitur * in_parent): parent(in_parent) {}
 
             const_value_type & operator* ();
             const_value_type * operator-> ();
@@ -53,12 +77,12 @@ namespace jw
 
             std::stack<const Symbol*> pointer_stack;
             const Symbol* current_item;
-            const Sequitur<Type> * parent;
+            const Sequitur * parent;
             };
 
         struct ForwardIter: public SequiturIter<ForwardIter>
             {
-            ForwardIter(const Sequitur<Type> * in_parent, Symbol* c): SequiturIter<ForwardIter>(in_parent)
+            ForwardIter(const Sequitur * in_parent, Symbol* c): SequiturIter<ForwardIter>(in_parent)
                 {
                 this->current_item = this->resolveForward(c);
                 }
@@ -68,7 +92,7 @@ namespace jw
 
         struct ReverseIter: public SequiturIter<ReverseIter>
             {
-            ReverseIter(const Sequitur<Type> * in_parent, Symbol* c): SequiturIter<ReverseIter>(in_parent)
+            ReverseIter(const Sequitur * in_parent, Symbol* c): SequiturIter<ReverseIter>(in_parent)
                 {
                 this->current_item = this->resolveBackward(c);
                 }
@@ -86,8 +110,8 @@ namespace jw
         const std::type_info & ValueType = typeid(Value);
 
         //let's simplify some names:
-        using DigramIndex = std::unordered_map<std::pair<SymbolWrapper,SymbolWrapper>,Symbol*>;
-        using RuleIndex = std::unordered_map<uint, Symbol*>;
+        using DigramIndex = jw::DigramIndex;
+        using RuleIndex = jw::RuleIndex;
         using Value = ValueSymbol<Type>;
 
         using const_iterator = ForwardIter;
@@ -101,6 +125,15 @@ namespace jw
         //linkMade if symbol not first one added.
         void push_back(Type);
 
+        //add count copies of value. Long runs go in as a ladder of rules, each
+        //twice the one below, taking O(log count) steps rather than O(count):
+        void pushRun(Type value, unsigned count);
+
+        //add everything in [first, last), picking out long runs for pushRun(). The
+        //rest is hashed a block at a time up front (see sequitur/prescan.hpp):
+        template<typename Iterator>
+        void pushRange(Iterator first, Iterator last);
+
         //get const iterators:
         const_iterator begin() const {return const_iterator(this, rule_index.at(0));}
         const_iterator end() const {return const_iterator(this, sequence_end);}
@@ -110,7 +143,52 @@ namespace jw
         //return const references to rules for deep inspection:
         const RuleIndex & getRules() const { return rule_index; }
 
-        //print things:
+        //what is told about rules as they come and go:
+        Observer & getObserver() { return observer; }
+        const Observer & getObserver() const { return observer; }
+
+        //number of uses of a rule in this grammar. Dictionary rules are shared,
+        //so their RuleHead counts don't belong to any one grammar; use this instead:
+        unsigned getRuleCount(const RuleHead * rule) const;
+
+        //make an immutable, flat copy of the grammar that is quicker to read from.
+        //Throws std::length_error if it has more symbols than 32 bit codes can
+        //number (see sequitur/frozengrammar.hpp):
+        FrozenGrammar<Type> freeze() const;
+
+        //hash and length of the whole sequence. Equal for any two grammars of the
+        //same sequence, however their rules differ, so it is cheap to compare:
+        const ContentHash & fingerprint() const { return static_cast<const RuleHead*>(rule_index.at(0))->getContentHash(); }
+
+        //renumber rules 0..n-1 in order of first use in the sequence, with nothing
+        //left to recycle (dictionary rules keep their IDs, and ours follow on from
+        //them). Handy before serialising the rules:
+        void compactRuleIds();
+
+        //splice other onto the end of this grammar. Rules in other that match one
+        //of ours are swapped for it, the rest are moved across, and only digrams
+        //in what came across are checked again. Both grammars must be primed with
+        //the same dictionary (or neither), and have the same rule depth limit;
+        //other is left empty:
+        void append(Sequitur && other);
+
+        //save everything needed to carry on building later (digram index and
+        //queues included) to path. It is written alongside and then moved into
+        //place, so an existing checkpoint survives a crash part way through.
+        //Type must be trivially copyable (see sequitur/checkpoint.hpp):
+        void checkpoint(const std::string & path) const;
+
+        //carry on from a checkpoint; a primed grammar needs its dictionary back:
+        static Sequitur resume(const std::string & path, std::shared_ptr<const Dictionary<Type>> dictionary = nullptr);
+
+        //write the grammar out: as text (rule by rule, as printRules() shows it),
+        //JSON, or a Graphviz digraph of which rules use which. All go through an
+        //OutputBuffer (see sequitur/exporter.hpp):
+        void exportText(OutputBuffer & out) const;
+        void exportJson(OutputBuffer & out) const;
+        void exportDot(OutputBuffer & out) const;
+
+        //print things (to std::cout):
         void printList(const Symbol *, unsigned int number) const;
         void printAll() const;
         void printSequence() const;
@@ -119,24 +197,126 @@ namespace jw
 
         unsigned size() const { return length; }
 
+        //empty the grammar for the next input, handing symbols back to the
+        //object pools and keeping index capacity around. Settings are kept:
+        //the dictionary, setExpansionBatch() (so finalize() is still needed at
+        //the end), setMaxRuleDepth(), traceLatency(), and the observer, which
+        //isn't told (see OnlineEncoder::reset()):
+        void reset();
+        void clear() { reset(); }
+
+        //defer rule utility: rules that drop to a single use are queued, and only
+        //expanded once batch_size of them have built up (0, the default, expands
+        //them immediately). finalize() expands anything still queued:
+        void setExpansionBatch(unsigned batch_size) { expansion_batch = batch_size; }
+        void finalize();
+
+        //refuse digrams whose rule would nest rules more than max_depth deep (0,
+        //the default, for no limit), so that iterators (whose stack holds a
+        //symbol per rule they are inside) and anything else walking down the
+        //rules go at most max_depth levels. A rule's body can't then get deeper
+        //than RuleHead::getDepth(). Some compression is lost, as repeats inside
+        //rules at the limit are left be. Rule depths are worked out again here,
+        //and if any is already deeper than max_depth, std::invalid_argument is
+        //thrown and the limit left as it was:
+        void setMaxRuleDepth(unsigned max_depth);
+        unsigned getMaxRuleDepth() const { return max_depth; }
+
+        //time every push_back(), and every growth of the digram index, into
+        //trace's histograms, handing slow calls to its hook; nullptr stops
+        //tracing. The trace must outlive the tracing (see sequitur/latency.hpp):
+        void traceLatency(LatencyTrace * trace);
+
+        //write the last few symbols of the sequence, and the rules they use, as
+        //exportText() would. This is where the last push_back() did its work:
+        void writeNeighbourhood(OutputBuffer & out, unsigned symbols = 16) const;
+
         //constructor:
         Sequitur();
-        //move constructor:
-        Sequitur(Sequitur<Type> &&)=default;
+        //start out with the rules in a dictionary (kept for reset()):
+        explicit Sequitur(std::shared_ptr<const Dictionary<Type>> dictionary);
+        //move constructor and assignment (which releases whatever this instance
+        //currently holds); either leaves other empty, as reset() would without
+        //a dictionary, so it can still be used:
+        Sequitur(Sequitur &&);
+        Sequitur & operator=(Sequitur &&);
         //destructor to clean up:
         ~Sequitur();
 
         private:
 
+        //RePair puts its rules together directly, then lets us index them:
+        friend class RePair<Type>;
+
+        //write number symbols from list (0 for all of them), and the digram index:
+        void writeList(OutputBuffer & out, const Symbol * list, unsigned int number) const;
+        void writeDigramIndex(OutputBuffer & out) const;
+
+        //create rule 0, which holds the sequence itself:
+        void makeStartRule();
+
+        //delete every symbol in every rule (memory goes back to the pools):
+        void deleteSymbols();
+
+        //point at the dictionary's rules, and start our counts for them at 0:
+        void primeFromDictionary();
+
+        //dictionary rules take IDs 1..dictionary_rules, and are left be by rule utility:
+        bool isDictionaryRule(uint id) const { return id && id <= dictionary_rules; }
+
+        //runs shorter than this aren't worth the lookups pushRun() makes:
+        static const unsigned min_run = 32;
+
+        //rule depth of a symbol (0 for values):
+        unsigned symbolDepth(const Symbol * item) const;
+
+        //deepest rule that can go where item is, under the depth limit: one less
+        //than the depth of the rule it's in, or the limit itself in rule 0:
+        unsigned depthRoom(Symbol * item) const;
+
+        //a rule whose whole body is [item item], or nullptr if there's none:
+        RuleHead * findDoubledRule(const Symbol * item);
+
+        //length of the run of equal values starting at first:
+        template<typename Iterator>
+        static std::size_t runLength(Iterator first, Iterator last, std::random_access_iterator_tag);
+        template<typename Iterator>
+        static std::size_t runLength(Iterator first, Iterator last, std::input_iterator_tag);
+
+        //values pushRange() hashes in one go, and how many of those it looks
+        //up together in the digram index (see pushBatch()):
+        static const std::size_t prescan_block = 256;
+        static const std::size_t probe_batch = 8;
+
+        //add a value symbol to the end of the sequence, checking the digram it makes:
+        void pushSymbol(Symbol * val);
+
+        //push_back(), timed into the latency trace:
+        void tracedPushBack(Type value);
+
+        //add a value symbol to the end of the sequence, and nothing more:
+        void appendValue(Symbol * val);
+
+        //add up to probe_batch values, whose hashes and digram hashes (as from
+        //prescan) are known. The digrams they make are looked up together, so
+        //the cache misses overlap; those that are new only need indexing, and
+        //from the first that isn't, values go in one at a time:
+        void pushBatch(const Type * values, const unsigned int * hashes, const std::uint64_t * digram_hashes, std::size_t count);
+
         //waht to do when a link is made between two symbols:
         void linkMade(Symbol * first);
 
+        //queue the digram starting at first to be checked by linkMade:
+        void queueLink(Symbol * first);
+
+        //run linkMade on queued digrams until there are none left. Rather than
+        //recursing, anything that creates new links queues them up here, so the
+        //stack depth stays constant however long the cascade is:
+        void processLinks();
+
         //return Iter pointing to digram location, OR end of sequence if none:
         Symbol * findAndAddDigram(Symbol *first);
 
-        //make a digram pair for use in the digram index:
-        std::pair<SymbolWrapper,SymbolWrapper> makeDigramPair(Symbol * first);
-
         //remove a digram from the digram index:
         void removeDigramFromIndex(Symbol * first);
 
@@ -146,9 +326,16 @@ namespace jw
         //swaps two occurrences with a new rule:
         std::pair<Symbol*,Symbol*> swapForNewRule(Symbol * first, Symbol * other);
 
+        //hash of what a symbol in a rule body expands to:
+        ContentHash symbolContent(const Symbol * item) const;
+
         //swaps a digram with an existing rule:
         Symbol *swapForExistingRule(Symbol * first, RuleHead *rule_head);
 
+        //change the count of a rule (our own count, for dictionary rules):
+        void incrementRule(RuleHead * rule);
+        void decrementRule(RuleHead * rule);
+
         //decrement Item if it's a rule:
         bool decrementIfRule(Symbol * item);
 
@@ -162,6 +349,39 @@ namespace jw
         //check for rules only used once in rule_container and expand if found:
         void expandRuleIfNecessary(Symbol * potential_rule);
 
+        //queue a rule symbol to be checked by expandRuleIfNecessary later on:
+        void queueExpansion(Symbol * potential_rule);
+
+        //expand queued rules until the queue is empty:
+        void processExpansions();
+
+        //delete a symbol, or hold onto it until it has left the queues:
+        void releaseSymbol(Symbol * item);
+
+        //delete released symbols, once no queue can refer to them:
+        void freeReleased();
+
+        //rules from a grammar being appended, and the rule of ours each is now:
+        using RuleMap = std::unordered_map<const RuleHead*, RuleHead*>;
+
+        //the rule a rule symbol being appended should point to:
+        RuleHead * mappedRule(const Symbol * rule_symbol, const RuleMap & mapped) const;
+
+        //copy of a symbol being appended, pointing to the right rule if it is one:
+        std::unique_ptr<Symbol> mappedCopy(const Symbol * item, const RuleMap & mapped) const;
+
+        //a rule of ours with the same body as rule (once mapped), or nullptr:
+        RuleHead * findIdenticalRule(RuleHead * rule, const RuleMap & mapped);
+
+        //point the rule symbols in an appended rule to the rules they're mapped to:
+        void remapRuleSymbols(RuleHead * rule, const RuleMap & mapped);
+
+        //replace every use of a single symbol rule with that symbol, and remove it:
+        void inlineShortRules();
+
+        //replace a use of a single symbol rule with that symbol, returning it:
+        Symbol * inlineShortRule(Symbol * use);
+
         //swapForRule(symbol it 1, symbol it 2)
         //Each time a digram is replaced by a symbol representing a rule
         //    For each symbol in the digram
@@ -175,56 +395,415 @@ namespace jw
         unsigned int length = 0;
         DigramIndex digram_index;
         RuleIndex rule_index;
+
+        std::shared_ptr<const Dictionary<Type>> dictionary;
+        unsigned int dictionary_rules = 0;
+        std::vector<unsigned int> dictionary_counts;
+
+        unsigned int expansion_batch = 0;
+        unsigned int max_depth = 0;
+        std::vector<Symbol*> pending_links;
+        std::vector<Symbol*> pending_expansions;
+        std::vector<Symbol*> released_symbols;
+        bool short_rules_made = false;
+        LatencyTrace * latency = nullptr;
+        Observer observer;
         };
 
     //CONSTRUCTOR
-    template<typename Type>
-    inline Sequitur<Type>::Sequitur()
+    template<typename Type, typename Observer>
+    inline Sequitur<Type, Observer>::Sequitur()
+        {
+        makeStartRule();
+        }
+
+    //MOVE CONSTRUCTOR
+    template<typename Type, typename Observer>
+    inline Sequitur<Type, Observer>::Sequitur(Sequitur<Type, Observer> && other)
+        {
+        //we hold no symbols yet, so assigning just takes other's:
+        *this = std::move(other);
+        }
+
+    //MOVE ASSIGNMENT
+    template<typename Type, typename Observer>
+    Sequitur<Type, Observer> & Sequitur<Type, Observer>::operator=(Sequitur<Type, Observer> && other)
+        {
+        if(this == &other) return *this;
+
+        deleteSymbols();
+
+        //type_info references are the same for every instance, so leave them be:
+        id_generator = std::move(other.id_generator);
+        sequence_end = other.sequence_end;
+        length = other.length;
+        digram_index = std::move(other.digram_index);
+        rule_index = std::move(other.rule_index);
+        dictionary = std::move(other.dictionary);
+        dictionary_rules = other.dictionary_rules;
+        dictionary_counts = std::move(other.dictionary_counts);
+        expansion_batch = other.expansion_batch;
+        max_depth = other.max_depth;
+        pending_links = std::move(other.pending_links);
+        pending_expansions = std::move(other.pending_expansions);
+        released_symbols = std::move(other.released_symbols);
+        short_rules_made = other.short_rules_made;
+        observer = std::move(other.observer);
+        latency = other.latency;
+        other.latency = nullptr;
+
+        //other no longer owns any symbols, or shares the dictionary's, so it
+        //starts again with a start rule of its own:
+        other.digram_index.clear();
+        other.rule_index.clear();
+        other.pending_links.clear();
+        other.pending_expansions.clear();
+        other.released_symbols.clear();
+        other.dictionary_rules = 0;
+        other.dictionary_counts.clear();
+        other.short_rules_made = false;
+        other.reset();
+        return *this;
+        }
+
+    //DESTRUCTOR
+    template<typename Type, typename Observer>
+    inline Sequitur<Type, Observer>::~Sequitur()
+        {
+        //delete symbols:
+        deleteSymbols();
+        rule_index.clear();
+
+        //clear digrams:
+        digram_index.clear();
+
+        //clear the object pools, freeing up all available memory:
+        //(won't free up used memory in the case of SinglePool)
+        ObjectPool<Value>::clear();
+        ObjectPool<RuleHead>::clear();
+        ObjectPool<RuleTail>::clear();
+        ObjectPool<RuleSymbol>::clear();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::makeStartRule()
         {
         RuleTail * start_tail = new RuleTail();
         RuleHead * start_head = new RuleHead(id_generator.get(), start_tail);
         start_head->insertAfter(start_tail);
         sequence_end = start_tail;
-        rule_index[start_head->getID()] = start_head;
+        rule_index.insert(start_head->getID(), start_head);
         }
 
-    //DESTRUCTOR
-    template<typename Type>
-    inline Sequitur<Type>::~Sequitur()
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::deleteSymbols()
         {
-        //delete symbols:
-        auto it = rule_index.begin();
-        while(it != rule_index.end())
+        for(auto & rule_pair : rule_index)
             {
-            it->second->forUntil([](Symbol * item)
+            //dictionary rules belong to the dictionary:
+            if(isDictionaryRule(rule_pair.first)) continue;
+            rule_pair.second->forUntil([](Symbol * item)
                 {
                 delete item;
                 return true;
                 });
-            it = rule_index.erase(it);
             }
 
-        //clear digrams:
+        //symbols held back for the queues are no longer in any rule:
+        for(Symbol * item : released_symbols) delete item;
+        released_symbols.clear();
+        pending_links.clear();
+        pending_expansions.clear();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::reset()
+        {
+        //unlike the destructor, we leave the object pools alone so the
+        //freed symbols are reused for the next input:
+        deleteSymbols();
+
+        //clear() keeps the bucket arrays, so no rehashing as we refill:
         digram_index.clear();
+        rule_index.clear();
 
-        //clear the object pools, freeing up all available memory:
-        //(won't free up used memory in the case of SinglePool)
-        ObjectPool<Value>::clear();
-        ObjectPool<RuleHead>::clear();
-        ObjectPool<RuleTail>::clear();
-        ObjectPool<RuleSymbol>::clear();
+        id_generator = ID();
+        length = 0;
+        makeStartRule();
+        primeFromDictionary();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::push_back(Type s)
+        {
+        if(latency) tracedPushBack(s);
+        else pushSymbol(new Value(s));
         }
 
-    template<typename Type>
-    void Sequitur<Type>::push_back(Type s)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::appendValue(Symbol * val)
+        {
+        sequence_end->insertBefore(val);
+        if(max_depth) val->setFlag(Symbol::InStart);
+        RuleHead * start_head = static_cast<RuleHead*>(rule_index.at(0));
+        start_head->setContentHash(ContentHash(start_head->getContentHash()).append(ContentHash::ofValue(static_cast<const Value*>(val)->getContentHash())));
+        ++length;
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::pushSymbol(Symbol * val)
         {
         //add new symbol:
-        Symbol * val = sequence_end->insertBefore(new Value(s));
-        if(++length > 1)
+        appendValue(val);
+        if(length > 1)
             {
             auto one_from_end = val->prev();
-            linkMade(one_from_end);
+            queueLink(one_from_end);
+            processLinks();
             }
+
+        if(expansion_batch && pending_expansions.size() >= expansion_batch)
+            processExpansions();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::pushRun(Type value, unsigned count)
+        {
+        if(count < min_run)
+            {
+            while(count--) push_back(value);
+            return;
+            }
+
+        //level i below is i rules deep, so under a depth limit, runs needing
+        //levels past it go in as several runs that don't:
+        if(max_depth && max_depth < 30 && count >> (max_depth + 1) > 1)
+            {
+            unsigned longest = 2u << max_depth;
+            for(; count >= longest; count -= longest) pushRun(value, longest);
+            pushRun(value, count);
+            return;
+            }
+
+        //level i stands for 2^i copies of value: level 0 is the value itself, and
+        //level i a rule [level i-1, level i-1]. Rules we have already are reused,
+        //and the rest made, bar the top one, which would only be used once:
+        unsigned top = 0;
+        while(count >> top > 1) ++top;
+
+        std::vector<RuleHead*> levels(top+1, nullptr);
+        auto placeLevel = [&](unsigned level, Symbol * before) -> Symbol*
+            {
+            if(!level) return before->insertBefore(new Value(value));
+            Symbol * item = before->insertBefore(levels[level]->makeRuleSymbol().release());
+            incrementRule(levels[level]);
+            observer.ruleUsed(levels[level], item);
+            return item;
+            };
+
+        std::vector<RuleHead*> made;
+        for(unsigned level = 1; level <= top; ++level)
+            {
+            if(made.empty())
+                {
+                std::unique_ptr<Symbol> sample;
+                if(level > 1) sample = levels[level-1]->makeRuleSymbol();
+                else sample.reset(new Value(value));
+                levels[level] = findDoubledRule(sample.get());
+
+                //a rule found (one from a dictionary, say) may be deeper than
+                //the level, or the top level deeper than the limit allows:
+                unsigned room = max_depth && max_depth < level? max_depth : level;
+                if(levels[level] && max_depth && levels[level]->getDepth() > room) levels[level] = nullptr;
+                if(levels[level]) continue;
+                }
+            if(level == top) break;
+
+            RuleTail * rule_tail = new RuleTail();
+            RuleHead * rule_head = new RuleHead(id_generator.get(), rule_tail);
+            rule_head->insertAfter(rule_tail);
+            rule_index.insert(rule_head->getID(), rule_head);
+
+            Symbol * half = placeLevel(level-1, rule_tail);
+            placeLevel(level-1, rule_tail);
+            rule_head->setContentHash(symbolContent(half).append(symbolContent(half)));
+            rule_head->setDepth(symbolDepth(half) + 1);
+            observer.ruleCreated(rule_head);
+
+            levels[level] = rule_head;
+            made.push_back(rule_head);
+            }
+
+        //the sequence gets the top level (or two of the one below), then a level
+        //for each bit set in what's left:
+        RuleHead * start_head = static_cast<RuleHead*>(rule_index.at(0));
+        ContentHash content = start_head->getContentHash();
+        Symbol * seam = sequence_end->prev();
+        auto appendLevel = [&](unsigned level)
+            {
+            Symbol * item = placeLevel(level, sequence_end);
+            if(max_depth) item->setFlag(Symbol::InStart);
+            content.append(symbolContent(item));
+            };
+
+        if(levels[top]) appendLevel(top);
+        else
+            {
+            appendLevel(top-1);
+            appendLevel(top-1);
+            }
+        for(unsigned level = top; level--; )
+            {
+            if(count & (1u << level)) appendLevel(level);
+            }
+        start_head->setContentHash(content);
+        length += count;
+
+        //check the digrams we've made, and the one at the seam, in order:
+        std::vector<Symbol*> new_digrams;
+        for(RuleHead * rule : made) new_digrams.push_back(rule->next());
+        if(typeid(*seam) == RuleHeadType) seam = seam->next();
+        for(Symbol * item = seam; item->next() != sequence_end; item = item->next())
+            new_digrams.push_back(item);
+
+        for(auto iter = new_digrams.rbegin(); iter != new_digrams.rend(); ++iter) queueLink(*iter);
+        processLinks();
+        inlineShortRules();
+
+        if(expansion_batch && pending_expansions.size() >= expansion_batch)
+            processExpansions();
+        }
+
+    template<typename Type, typename Observer>
+    template<typename Iterator>
+    void Sequitur<Type, Observer>::pushRange(Iterator first, Iterator last)
+        {
+        typename std::iterator_traits<Iterator>::iterator_category category;
+        std::vector<Type> block;
+        std::vector<unsigned int> hashes;
+        std::vector<std::uint64_t> digram_hashes;
+        std::size_t run = first != last? runLength(first, last, category) : 0;
+        while(first != last)
+            {
+            if(run >= min_run)
+                {
+                pushRun(*first, run);
+                std::advance(first, run);
+                run = first != last? runLength(first, last, category) : 0;
+                continue;
+                }
+
+            //gather values up to the next long run, and hash them all at once:
+            block.clear();
+            while(run < min_run && block.size() < prescan_block)
+                {
+                for(; run; --run, ++first) block.push_back(*first);
+                if(first == last) break;
+                run = runLength(first, last, category);
+                }
+            hashes.resize(block.size());
+            digram_hashes.resize(block.size());
+            prescan::hashValues(block.data(), block.size(), hashes.data());
+            prescan::hashDigrams(hashes.data(), block.size(), digram_hashes.data());
+
+            //while one batch goes in, fetch the slots of the digrams the next will
+            //probably make ([block[i-1] block[i]], unless a rule has replaced block[i-1]):
+            for(std::size_t i = 0; i < block.size(); i += probe_batch)
+                {
+                for(std::size_t next = i + probe_batch - 1; next < i + 2*probe_batch - 1 && next + 1 < block.size(); ++next)
+                    digram_index.prefetch(digram_hashes[next]);
+                std::size_t count = block.size() - i < probe_batch? block.size() - i : probe_batch;
+                pushBatch(&block[i], &hashes[i], &digram_hashes[i], count);
+                }
+            }
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::pushBatch(const Type * values, const unsigned int * hashes, const std::uint64_t * digram_hashes, std::size_t count)
+        {
+        //the digram ending at each value; the first links onto whatever ends the sequence now:
+        Symbol * items[probe_batch];
+        std::uint64_t probes[probe_batch];
+        Symbol * last = length? sequence_end->prev() : nullptr;
+        for(std::size_t j = 0; j < count; ++j) items[j] = new Value(values[j], hashes[j]);
+        if(last) probes[0] = DigramIndex::hashOf(last->getHash(), hashes[0]);
+        for(std::size_t j = 1; j < count; ++j) probes[j] = digram_hashes[j-1];
+
+        //values up to the first digram that is indexed already, or repeats one
+        //before it in the batch (equal digrams hash the same), just need their
+        //digrams indexing:
+        const std::size_t start = last? 0 : 1;
+        std::size_t fresh = start;
+        for(; fresh < count; ++fresh)
+            {
+            const Symbol & first = fresh? *items[fresh-1] : *last;
+            if(digram_index.find(first, *items[fresh], probes[fresh])) break;
+            if(dictionary && dictionary->findDigram(first, *items[fresh], probes[fresh])) break;
+            bool repeated = false;
+            for(std::size_t k = start; k < fresh; ++k) repeated |= probes[k] == probes[fresh];
+            if(repeated) break;
+            }
+
+        std::size_t j = 0;
+        for(; j < fresh; ++j)
+            {
+            appendValue(items[j]);
+            if(j >= start) digram_index.insert(items[j]->prev(), probes[j]);
+            }
+        //the rest go in one at a time, as they may make or use rules:
+        for(; j < count; ++j) pushSymbol(items[j]);
+
+        if(expansion_batch && pending_expansions.size() >= expansion_batch)
+            processExpansions();
+        }
+
+    template<typename Type, typename Observer>
+    template<typename Iterator>
+    std::size_t Sequitur<Type, Observer>::runLength(Iterator first, Iterator last, std::random_access_iterator_tag)
+        {
+        //compare a block at a time, without stopping part way through one, so
+        //that the compiler can vectorise it:
+        const Type value = *first;
+        Iterator current = first + 1;
+        const int block = 16;
+        while(last - current >= block)
+            {
+            bool same = true;
+            for(int i = 0; i < block; ++i) same &= (current[i] == value);
+            if(!same) break;
+            current += block;
+            }
+        while(current != last && *current == value) ++current;
+        return current - first;
+        }
+
+    template<typename Type, typename Observer>
+    template<typename Iterator>
+    std::size_t Sequitur<Type, Observer>::runLength(Iterator first, Iterator last, std::input_iterator_tag)
+        {
+        //single pass iterators can't be looked ahead on, so take one at a time:
+        (void)last;
+        return first != last? 1 : 0;
+        }
+
+    template<typename Type, typename Observer>
+    RuleHead * Sequitur<Type, Observer>::findDoubledRule(const Symbol * item)
+        {
+        std::uint64_t hash = DigramIndex::hashOf(item->getHash(), item->getHash());
+
+        Symbol * found = nullptr;
+        if(dictionary) found = dictionary->findDigram(*item, *item, hash);
+        if(!found) found = digram_index.find(*item, *item, hash);
+        if(!found) return nullptr;
+
+        RuleHead * rule = getCompleteRule(found);
+        return (rule && rule->getID())? rule : nullptr;
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::finalize()
+        {
+        processExpansions();
         }
 
 
@@ -241,8 +820,8 @@ namespace jw
     //        Add this digram to the index
     //    Else
     //        Do nothing (because other digram is overlapping).
-    template<typename Type>
-    void Sequitur<Type>::linkMade(Symbol * first)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::linkMade(Symbol * first)
         {
         assert(first != nullptr && "###linkMade: No nullptr expected here###");
         assert(first->isNext() && "###linkMade: digram has only one symbol###");
@@ -261,6 +840,25 @@ namespace jw
             //if other occurrence is not a rule:
             if(!rule_head)
                 {
+                //if this digram is a whole rule (as appended rules can be), the
+                //other occurrence can be swapped for that:
+                RuleHead * first_rule = getCompleteRule(first);
+                if(first_rule && first_rule->getID())
+                    {
+                    if(max_depth && first_rule->getDepth() > depthRoom(match_location)) return;
+                    digram_index.assign(first);
+                    Symbol * location = swapForExistingRule(match_location, first_rule);
+                    checkNewLinks(location);
+                    return;
+                    }
+
+                //under a depth limit, the new rule must fit where both occurrences are:
+                if(max_depth)
+                    {
+                    unsigned depth = std::max(symbolDepth(first), symbolDepth(first->next())) + 1;
+                    if(depth > depthRoom(first) || depth > depthRoom(match_location)) return;
+                    }
+
                 //match_location already in digram index, so swap that for new rule:
                 auto locations = swapForNewRule(first, match_location);
                 checkNewLinks(locations.first, locations.second);
@@ -268,6 +866,13 @@ namespace jw
             //if it is a rule...
             else
                 {
+                if(max_depth && rule_head->getDepth() > depthRoom(first)) return;
+
+                //if this digram is a whole rule too, that rule is left as just
+                //[rule_head] (only appending can get us here), to be inlined later:
+                RuleHead * first_rule = getCompleteRule(first);
+                if(first_rule && first_rule->getID()) short_rules_made = true;
+
                 //replace digram with rule symbol:
                 Symbol * location = swapForExistingRule(first, rule_head);
                 checkNewLinks(location);
@@ -275,20 +880,55 @@ namespace jw
             }
         }
 
-    template<typename Type>
-    Symbol * Sequitur<Type>::findAndAddDigram(Symbol * first)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::queueLink(Symbol * first)
+        {
+        //no need to queue a digram twice; it's checked as it is when processed:
+        if(first->hasFlag(Symbol::QueuedLink)) return;
+
+        first->setFlag(Symbol::QueuedLink);
+        pending_links.push_back(first);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::processLinks()
+        {
+        while(!pending_links.empty())
+            {
+            Symbol * first = pending_links.back();
+            pending_links.pop_back();
+            first->clearFlag(Symbol::QueuedLink);
+
+            //the digram may have been removed or changed since it was queued:
+            if(first->hasFlag(Symbol::Released)) continue;
+            if(typeid(*first) == RuleHeadType) continue;
+            if(typeid(*(first->next())) == RuleTailType) continue;
+
+            linkMade(first);
+            }
+
+        freeReleased();
+        }
+
+    template<typename Type, typename Observer>
+    Symbol * Sequitur<Type, Observer>::findAndAddDigram(Symbol * first)
         {
         assert(first->isNext() && "###Digram is invalid!###");
 
-        //place this pair into digram_index if it doesnt exist:
-        auto out_pair = digram_index.emplace(makeDigramPair(first),first);
+        std::uint64_t hash = DigramIndex::hashOf(first);
+
+        //dictionary digrams are each a complete rule, and can't overlap ours:
+        if(dictionary)
+            {
+            Symbol * shared_first = dictionary->findDigram(*first, *(first->next()), hash);
+            if(shared_first) return shared_first;
+            }
 
-        //get bool indicating whether insertion took place, and iter to location:
-        bool inserted = out_pair.second;
-        Symbol * other_first = out_pair.first->second;
+        //place this digram into digram_index if it doesnt exist, getting back where it is:
+        Symbol * other_first = digram_index.insert(first, hash);
 
-        //if already inserted, return end:
-        if(inserted) return nullptr;
+        //if just inserted (or already pointing here), return end:
+        if(other_first == first) return nullptr;
 
         //check for overlap:
         if(other_first->next() == first || other_first == first->next())
@@ -298,39 +938,19 @@ namespace jw
         else return other_first;
         }
 
-    template<typename Type>
-    std::pair<SymbolWrapper,SymbolWrapper> Sequitur<Type>::makeDigramPair(Symbol *first)
-        {
-        //while we can, we should not ever be making digram pairs out of ruleheads or ruletails:
-        assert(first->isNext());
-        assert(typeid(*first) != typeid(RuleHead*));
-        assert(typeid(first->next()) != typeid(RuleTail*));
-
-        //make a copy whatever symbols are in our digram:
-        std::unique_ptr<Symbol> first_copy = first->clone();
-        std::unique_ptr<Symbol> second_copy = first->next()->clone();
-
-        //and add these to a pair, moving them to pass ownerhsip into container:
-        return std::make_pair(std::move(first_copy), std::move(second_copy));
-        }
-
-    template<typename Type>
-    void Sequitur<Type>::removeDigramFromIndex(Symbol *first)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::removeDigramFromIndex(Symbol *first)
         {
         if(typeid(*first) == RuleHeadType) return;
         if(typeid(*(first->next())) == RuleTailType) return;
 
         //digram must be pointed at Item to be removed:
-        auto iter = digram_index.find(makeDigramPair(first));
-        if(iter != digram_index.end() && iter->second == first)
-            {
-            digram_index.erase(iter);
-            }
+        digram_index.erase(first);
         }
 
 
-    template<typename Type>
-    RuleHead * Sequitur<Type>::getCompleteRule(Symbol * first)
+    template<typename Type, typename Observer>
+    RuleHead * Sequitur<Type, Observer>::getCompleteRule(Symbol * first)
         {
         assert(first->isNext() && "should be at least one symbol following this");
 
@@ -343,14 +963,14 @@ namespace jw
         else return nullptr;
         }
 
-    template<typename Type>
-    std::pair<Symbol *, Symbol *> Sequitur<Type>::swapForNewRule(Symbol *match1, Symbol *match2)
+    template<typename Type, typename Observer>
+    std::pair<Symbol *, Symbol *> Sequitur<Type, Observer>::swapForNewRule(Symbol *match1, Symbol *match2)
         {
         assert(match1->next() && "first should be part of a digram");
         assert(match2->next() && "other should be part of digram");
         assert(match1->prev() != match2 && "should be no overlap");
         assert(match2->next() != match1 && "should be no overlap");
-        assert(makeDigramPair(match1) == makeDigramPair(match2) && "digrams should be equal");
+        assert(match1->isEqual(*match2) && match1->next()->isEqual(*(match2->next())) && "digrams should be equal");
 
         Symbol * match1_second = match1->next();
 
@@ -362,11 +982,16 @@ namespace jw
         Symbol * rule_item2 = rule_item1->insertAfter(match1_second->clone().release());
         rule_item2->insertAfter(rule_tail);
 
+        //what the rule expands to never changes, so hash it now:
+        rule_head->setContentHash(symbolContent(rule_item1).append(symbolContent(rule_item2)));
+        rule_head->setDepth(std::max(symbolDepth(rule_item1), symbolDepth(rule_item2)) + 1);
+
         //point digram_index to rule now:
-        digram_index[makeDigramPair(match1)] = rule_item1;
+        digram_index.assign(rule_item1);
 
         //point rule index to rule too:
-        rule_index[rule_head->getID()] = rule_head;
+        rule_index.insert(rule_head->getID(), rule_head);
+        observer.ruleCreated(rule_head);
 
         //increment count of any rules in digram, as we've added a copy:
         incrementIfRule(match1);
@@ -380,13 +1005,13 @@ namespace jw
         return std::make_pair(loc1, loc2);
         }
 
-    template<typename Type>
-    Symbol * Sequitur<Type>::swapForExistingRule(Symbol *first, RuleHead *rule_head)
+    template<typename Type, typename Observer>
+    Symbol * Sequitur<Type, Observer>::swapForExistingRule(Symbol *first, RuleHead *rule_head)
         {
         assert(first->isPrev() && "should ALWAYS be one symbol before.");
         assert(first->isNext() && "incomplete digram.");
         assert(first->next()->isNext() && "should always be a tail after this digram.");
-        assert(rule_index.find(rule_head->getID()) != rule_index.end() && "rule should exist in index");
+        assert(rule_index.contains(rule_head->getID()) && "rule should exist in index");
 
         //replaces digram at first, with rule at rule_start (contains RuleHead)
         //- remove digrams around first (not first itself)
@@ -397,6 +1022,7 @@ namespace jw
 
         Symbol * second = first->next();
         Symbol * before_digram = first->prev();
+        bool in_start = first->hasFlag(Symbol::InStart);
 
         //remove digrams around match if they exist and point to same location:
         removeDigramFromIndex(second);
@@ -409,96 +1035,175 @@ namespace jw
         decrementIfRule(second);
 
         //now, we can delete the original digram elements entirely:
-        delete first;
-        delete second;
+        releaseSymbol(first);
+        releaseSymbol(second);
 
         //insert rule in it's place, incrementing its count:
         RuleSymbol * new_rule = rule_head->makeRuleSymbol().release();
-        new_rule->getRule()->increment();
+        if(in_start) new_rule->setFlag(Symbol::InStart);
+        incrementRule(rule_head);
 
-        //expand any rules contained within this rule now if needbe:
+        //expand any rules contained within this rule now if needbe
+        //(or leave it for later if expansion is being deferred):
         Symbol * rule_item1 = rule_head->next();
         Symbol * rule_item2 = rule_item1->next();
-        expandRuleIfNecessary(rule_item1);
-        expandRuleIfNecessary(rule_item2);
+        if(expansion_batch)
+            {
+            queueExpansion(rule_item1);
+            queueExpansion(rule_item2);
+            }
+        else
+            {
+            expandRuleIfNecessary(rule_item1);
+            expandRuleIfNecessary(rule_item2);
+            }
 
         //return position of rule in sequence:
-        return before_digram->insertAfter(new_rule);
+        Symbol * location = before_digram->insertAfter(new_rule);
+        observer.ruleUsed(rule_head, location);
+        return location;
+        }
+
+    template<typename Type, typename Observer>
+    unsigned Sequitur<Type, Observer>::getRuleCount(const RuleHead * rule) const
+        {
+        if(isDictionaryRule(rule->getID())) return dictionary_counts[rule->getID()];
+        else return rule->getCount();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::incrementRule(RuleHead * rule)
+        {
+        if(isDictionaryRule(rule->getID())) ++dictionary_counts[rule->getID()];
+        else rule->increment();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::decrementRule(RuleHead * rule)
+        {
+        if(!isDictionaryRule(rule->getID())) rule->decrement();
+        else if(!dictionary_counts[rule->getID()]) throw std::range_error("count not allowed to drop below 0.");
+        else --dictionary_counts[rule->getID()];
+        }
+
+    template<typename Type, typename Observer>
+    ContentHash Sequitur<Type, Observer>::symbolContent(const Symbol * item) const
+        {
+        if(typeid(*item) == RuleSymbolType) return static_cast<const RuleSymbol*>(item)->getRule()->getContentHash();
+        else return ContentHash::ofValue(static_cast<const Value*>(item)->getContentHash());
+        }
+
+    template<typename Type, typename Observer>
+    unsigned Sequitur<Type, Observer>::symbolDepth(const Symbol * item) const
+        {
+        if(typeid(*item) == RuleSymbolType) return static_cast<const RuleSymbol*>(item)->getRule()->getDepth();
+        else return 0;
+        }
+
+    template<typename Type, typename Observer>
+    unsigned Sequitur<Type, Observer>::depthRoom(Symbol * item) const
+        {
+        //symbols in rule 0 are flagged, as walking back to its head could take a while:
+        if(item->hasFlag(Symbol::InStart)) return max_depth;
+        while(typeid(*item) != RuleHeadType) item = item->prev();
+        const RuleHead * rule = static_cast<const RuleHead*>(item);
+        return rule->getID()? rule->getDepth() - 1 : max_depth;
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::setMaxRuleDepth(unsigned new_max_depth)
+        {
+        //rule bodies may have got deeper since they were made:
+        rule_index.setDepths(dictionary_rules + 1);
+        if(new_max_depth)
+            {
+            //(dictionary rules only matter once used):
+            for(const auto & rule_pair : rule_index)
+                {
+                const RuleHead * rule = static_cast<const RuleHead*>(rule_pair.second);
+                if(!rule_pair.first || (isDictionaryRule(rule_pair.first) && !getRuleCount(rule))) continue;
+                if(rule->getDepth() > new_max_depth)
+                    throw std::invalid_argument("grammar already has rules deeper than the depth limit.");
+                }
+            for(Symbol * item = rule_index.at(0)->next(); item != sequence_end; item = item->next())
+                item->setFlag(Symbol::InStart);
+            }
+        max_depth = new_max_depth;
         }
 
     //decrement Item if it's a rule:
-    template<typename Type>
-    bool Sequitur<Type>::decrementIfRule(Symbol *item)
+    template<typename Type, typename Observer>
+    bool Sequitur<Type, Observer>::decrementIfRule(Symbol *item)
         {
         if(typeid(*item) == RuleSymbolType)
             {
-            static_cast<RuleSymbol*>(item)->getRule()->decrement();
+            decrementRule(static_cast<RuleSymbol*>(item)->getRule());
             return true;
             }
         else return false;
         }
 
     //increment if it's a rule:
-    template<typename Type>
-    bool Sequitur<Type>::incrementIfRule(Symbol *item)
+    template<typename Type, typename Observer>
+    bool Sequitur<Type, Observer>::incrementIfRule(Symbol *item)
         {
         if(typeid(*item) == RuleSymbolType)
             {
-            static_cast<RuleSymbol*>(item)->getRule()->increment();
+            incrementRule(static_cast<RuleSymbol*>(item)->getRule());
             return true;
             }
         else return false;
         }
 
-    template<typename Type>
-    void Sequitur<Type>::checkNewLinks(Symbol * rule1, Symbol * rule2)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::checkNewLinks(Symbol * rule1, Symbol * rule2)
         {
         assert(typeid(rule1) != typeid(RuleTail*) && "rule1 should never point to a RuleTail");
         assert(typeid(rule2) != typeid(RuleTail*) && "rule2 should never point to a RuleTail");
 
         //get any UNIQUE iterators to starts of digrams given that we inserted rule1 and rule2
-        //and check them:
-
-        //1. check digram at position rule1 if there is something valid following it.
-        auto rule1_next = rule1->next();
-        if(typeid(*rule1_next) != RuleTailType && typeid(*rule1) != RuleHeadType)
-            linkMade(rule1);
+        //and queue them for checking (last queued is checked first, so go backwards):
 
-        //2. check digram at position rule2 if there is something valid following it:
-        auto rule2_next = rule2->next();
-        if(typeid(*rule2_next) != RuleTailType && typeid(*rule2) != RuleHeadType)
-            linkMade(rule2);
+        //4. check digram at position --rule1 if it exists and is not equal to rule2:
+        auto rule1_prev = rule1->prev();
+        if(rule1_prev != rule2 && typeid(*rule1_prev) != RuleHeadType)
+            queueLink(rule1_prev);
 
         //3. check digram at position --rule2 if it exists and is not equal to rule1:
         auto rule2_prev = rule2->prev();
         if(rule2_prev != rule1 && typeid(*rule2_prev) != RuleHeadType)
-            linkMade(rule2_prev);
+            queueLink(rule2_prev);
 
-        //4. check digram at position --rule1 if it exists and is not equal to rule2:
-        auto rule1_prev = rule1->prev();
-        if(rule1_prev != rule2 && typeid(*rule1_prev) != RuleHeadType)
-            linkMade(rule1_prev);
+        //2. check digram at position rule2 if there is something valid following it:
+        auto rule2_next = rule2->next();
+        if(typeid(*rule2_next) != RuleTailType && typeid(*rule2) != RuleHeadType)
+            queueLink(rule2);
+
+        //1. check digram at position rule1 if there is something valid following it.
+        auto rule1_next = rule1->next();
+        if(typeid(*rule1_next) != RuleTailType && typeid(*rule1) != RuleHeadType)
+            queueLink(rule1);
         }
 
-    template<typename Type>
-    void Sequitur<Type>::checkNewLinks(Symbol *rule1)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::checkNewLinks(Symbol *rule1)
         {
         assert(typeid(*rule1) != typeid(RuleTail) && "rule should never point to a RuleTail");
 
-        //1. check digram at position rule if something valid following it:
-        auto rule1_next = rule1->next();
-        if(typeid(*rule1_next) != RuleTailType && typeid(*rule1) != RuleHeadType)
-            linkMade(rule1);
-
         //2. check digram at position --rule if it exists and is valid:
         auto rule1_prev = rule1->prev();
         if(typeid(*rule1_prev) != RuleHeadType)
-            linkMade(rule1_prev);
+            queueLink(rule1_prev);
+
+        //1. check digram at position rule if something valid following it:
+        auto rule1_next = rule1->next();
+        if(typeid(*rule1_next) != RuleTailType && typeid(*rule1) != RuleHeadType)
+            queueLink(rule1);
 
         }
 
-    template<typename Type>
-    void Sequitur<Type>::expandRuleIfNecessary(Symbol *potential_rule)
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::expandRuleIfNecessary(Symbol *potential_rule)
         {
         assert(typeid(*potential_rule) != typeid(RuleHead));
         assert(typeid(*potential_rule) != typeid(RuleTail));
@@ -508,9 +1213,12 @@ namespace jw
 
         RuleSymbol * rule_symbol = static_cast<RuleSymbol*>(potential_rule);
 
+        //dictionary rules stay put however often they are used:
+        if(isDictionaryRule(rule_symbol->getID())) return;
+
         //a couple of checks to make sure nothing is broken:
         assert(rule_symbol->getCount() && "count should never be 0");
-        assert(rule_index.find(rule_symbol->getID()) != rule_index.end() && "rule no exist!");
+        assert(rule_index.contains(rule_symbol->getID()) && "rule no exist!");
 
         //if rule symbol count is not 1 (or 0) leave it be:
         if(rule_symbol->getCount() != 1) return;
@@ -546,95 +1254,432 @@ namespace jw
         rule_head_item->splitAfter();
         rule_tail_item->splitBefore();
 
-        //now we no longer need them, we can delete them:
-        delete rule_head_item;
-        delete rule_tail_item;
-
         //unlink and delete the rule symbol:
+        bool in_start = potential_rule->hasFlag(Symbol::InStart);
         potential_rule->splitBefore();
         potential_rule->splitAfter();
-        delete potential_rule;
+        releaseSymbol(potential_rule);
 
         //join up the pieces:
         before_potential_rule->joinAfter(rule_first_item);
         after_potential_rule->joinBefore(rule_last_item);
+        if(in_start)
+            {
+            for(Symbol * item = rule_first_item; item != after_potential_rule; item = item->next())
+                item->setFlag(Symbol::InStart);
+            }
+        observer.ruleInlined(rule_head_item, rule_first_item, rule_last_item);
+        observer.ruleRemoved(rule_head_item);
 
-        //now, check new digrams made if they don't contain rule heads or tails:
-        if(typeid(*before_potential_rule) != RuleHeadType) linkMade(before_potential_rule);
-        if(typeid(*(rule_last_item->next())) != RuleTailType) linkMade(rule_last_item);
+        //now we no longer need them, we can delete them:
+        delete rule_head_item;
+        delete rule_tail_item;
+
+        //now, queue new digrams made if they don't contain rule heads or tails:
+        if(typeid(*(rule_last_item->next())) != RuleTailType) queueLink(rule_last_item);
+        if(typeid(*before_potential_rule) != RuleHeadType) queueLink(before_potential_rule);
         }
 
-    template<typename Type>
-    void Sequitur<Type>::printList(const Symbol * list, unsigned int number) const
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::compactRuleIds()
         {
-        list->forUntil([&number,this](const Symbol * item)
+        //walk the sequence depth first, noting rules the first time we enter them:
+        std::vector<RuleHead*> order;
+        std::vector<bool> seen;
+        std::vector<Symbol*> position_stack;
+
+        RuleHead * start_head = static_cast<RuleHead*>(rule_index.at(0));
+        order.push_back(start_head);
+        position_stack.push_back(start_head->next());
+
+        while(!position_stack.empty())
             {
-            if(typeid(*item) == ValueType)
+            Symbol * current = position_stack.back();
+            if(typeid(*current) == RuleTailType)
                 {
-                std::cout << static_cast<const Value*>(item)->getValue() << " ";
+                position_stack.pop_back();
+                continue;
                 }
-            else if(typeid(*item) == RuleSymbolType)
+            position_stack.back() = current->next();
+
+            if(typeid(*current) != RuleSymbolType) continue;
+            RuleHead * rule = static_cast<RuleSymbol*>(current)->getRule();
+            if(isDictionaryRule(rule->getID())) continue;
+            if(rule->getID() >= seen.size()) seen.resize(rule->getID()+1, false);
+            if(seen[rule->getID()]) continue;
+
+            seen[rule->getID()] = true;
+            order.push_back(rule);
+            position_stack.push_back(rule->next());
+            }
+
+        assert(order.size() + dictionary_rules == rule_index.size() && "every rule should be reachable from rule 0");
+
+        //renumber, and start handing out IDs after the last one:
+        std::vector<RuleHead*> dictionary_order;
+        for(uint id = 1; id <= dictionary_rules; ++id)
+            dictionary_order.push_back(static_cast<RuleHead*>(rule_index.at(id)));
+
+        rule_index.clear();
+        for(RuleHead * rule : dictionary_order) rule_index.insert(rule->getID(), rule);
+        for(uint i = 0; i < order.size(); ++i)
+            {
+            uint id = i? i + dictionary_rules : 0;
+            order[i]->setID(id);
+            rule_index.insert(id, order[i]);
+            }
+        id_generator = ID(order.size() + dictionary_rules);
+
+        //rule symbols hash by ID, so both they and the digram index need redoing:
+        for(RuleHead * rule : order)
+            {
+            rule->forUntil([this](Symbol * item)
                 {
-                std::cout << "[" << static_cast<const RuleSymbol*>(item)->getID() << "] ";
-                }
-            else if(typeid(*item) == RuleHeadType)
+                if(typeid(*item) == RuleSymbolType) static_cast<RuleSymbol*>(item)->updateHash();
+                return true;
+                });
+            }
+
+        std::vector<Symbol*> digram_locations;
+        digram_locations.reserve(digram_index.size());
+        for(Symbol * location : digram_index) digram_locations.push_back(location);
+
+        digram_index.clear();
+        for(Symbol * location : digram_locations) digram_index.insert(location);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::append(Sequitur<Type, Observer> && other)
+        {
+        if(this == &other) throw std::invalid_argument("can't append a grammar to itself.");
+        if(other.dictionary != dictionary) throw std::invalid_argument("can't append a grammar primed with another dictionary.");
+        if(other.max_depth != max_depth) throw std::invalid_argument("can't append a grammar with another rule depth limit.");
+
+        //rules used once should be gone from other before we compare rules:
+        other.finalize();
+
+        //walk other's rules children first, so that by the time we look at a rule,
+        //we know what each rule it uses has become. Rules with a match among ours
+        //are dropped, and the rest are given one of our IDs:
+        struct Position { RuleHead * rule; Symbol * current; };
+        std::vector<Position> position_stack;
+        std::vector<RuleHead*> kept;
+        std::vector<RuleHead*> dropped;
+        RuleMap mapped;
+
+        RuleHead * other_start = static_cast<RuleHead*>(other.rule_index.at(0));
+        position_stack.push_back({other_start, other_start->next()});
+
+        while(!position_stack.empty())
+            {
+            Position & position = position_stack.back();
+            Symbol * current = position.current;
+            if(typeid(*current) == RuleTailType)
                 {
-                std::cout << "[" << static_cast<const RuleHead*>(item)->getID()
-                          << "(" << static_cast<const RuleHead*>(item)->getCount() << ")]: < ";
+                RuleHead * rule = position.rule;
+                position_stack.pop_back();
+                if(rule == other_start) continue;
+
+                //under a depth limit, ours mustn't be deeper than where rule is used:
+                RuleHead * identical = findIdenticalRule(rule, mapped);
+                if(identical && max_depth && identical->getDepth() > rule->getDepth()) identical = nullptr;
+                if(identical)
+                    {
+                    mapped[rule] = identical;
+                    dropped.push_back(rule);
+                    }
+                else
+                    {
+                    rule->setID(id_generator.get());
+                    mapped[rule] = rule;
+                    kept.push_back(rule);
+                    }
+                continue;
                 }
-            else if(typeid(*item) == RuleTailType)
+            position.current = current->next();
+
+            if(typeid(*current) != RuleSymbolType) continue;
+            RuleHead * rule = static_cast<RuleSymbol*>(current)->getRule();
+            if(isDictionaryRule(rule->getID()) || mapped.count(rule)) continue;
+            mapped[rule] = nullptr;
+            position_stack.push_back({rule, rule->next()});
+            }
+
+        //move kept rules across:
+        for(RuleHead * rule : kept)
+            {
+            remapRuleSymbols(rule, mapped);
+            rule_index.insert(rule->getID(), rule);
+            }
+        remapRuleSymbols(other_start, mapped);
+
+        //dropped rules only use rules of ours (a rule of ours can't match one
+        //using a kept rule), so deleting them changes no counts:
+        for(RuleHead * rule : dropped)
+            {
+            rule->forUntil([](Symbol * item)
                 {
-                std::cout << ">";
-                }
+                delete item;
+                return true;
+                });
+            }
 
-            if(!--number) return false;
-            else return true;
-            });
+        //splice the sequence itself onto the end of ours:
+        Symbol * seam = sequence_end->prev();
+        RuleTail * other_end = other_start->getTail();
+        if(other_start->next() != other_end)
+            {
+            Symbol * other_first = other_start->splitAfter();
+            Symbol * other_last = other_end->splitBefore();
+            sequence_end->splitBefore();
+            seam->joinAfter(other_first);
+            other_last->joinAfter(sequence_end);
+            }
+        RuleHead * start_head = static_cast<RuleHead*>(rule_index.at(0));
+        start_head->setContentHash(ContentHash(start_head->getContentHash()).append(other_start->getContentHash()));
+        delete other_start;
+        delete other_end;
+        length += other.length;
+
+        //other no longer owns any symbols (and the digram index is ours to rebuild):
+        other.rule_index.clear();
+        other.digram_index.clear();
+        other.reset();
+
+        //check every digram that came across, and the one at the seam. Queue them
+        //backwards, so that they're checked in order:
+        std::vector<Symbol*> new_digrams;
+        for(RuleHead * rule : kept)
+            {
+            for(Symbol * item = rule->next(); typeid(*(item->next())) != RuleTailType; item = item->next())
+                new_digrams.push_back(item);
+            }
+        if(typeid(*seam) == RuleHeadType) seam = seam->next();
+        for(Symbol * item = seam; item != sequence_end && item->next() != sequence_end; item = item->next())
+            new_digrams.push_back(item);
+
+        for(auto iter = new_digrams.rbegin(); iter != new_digrams.rend(); ++iter) queueLink(*iter);
+        processLinks();
+        inlineShortRules();
 
+        if(expansion_batch && pending_expansions.size() >= expansion_batch)
+            processExpansions();
         }
 
-    template<typename Type>
-    void Sequitur<Type>::printSequence() const
+    template<typename Type, typename Observer>
+    RuleHead * Sequitur<Type, Observer>::mappedRule(const Symbol * rule_symbol, const RuleMap & mapped) const
         {
-        printList(rule_index.at(0), 0);
-        std::cout << std::endl;
+        RuleHead * rule = static_cast<const RuleSymbol*>(rule_symbol)->getRule();
+        if(isDictionaryRule(rule->getID())) return rule;
+        else return mapped.at(rule);
         }
 
-    template<typename Type>
-    void Sequitur<Type>::printRules() const
+    template<typename Type, typename Observer>
+    std::unique_ptr<Symbol> Sequitur<Type, Observer>::mappedCopy(const Symbol * item, const RuleMap & mapped) const
         {
-        for(const auto & rule_pair : rule_index )
+        if(typeid(*item) == RuleSymbolType) return mappedRule(item, mapped)->makeRuleSymbol();
+        else return item->clone();
+        }
+
+    template<typename Type, typename Observer>
+    RuleHead * Sequitur<Type, Observer>::findIdenticalRule(RuleHead * rule, const RuleMap & mapped)
+        {
+        //digrams are unique, so a rule identical to this one must be where its
+        //first digram is (in our index, or the dictionary's):
+        Symbol * first = rule->next();
+        std::unique_ptr<Symbol> first_copy = mappedCopy(first, mapped);
+        std::unique_ptr<Symbol> second_copy = mappedCopy(first->next(), mapped);
+        std::uint64_t hash = DigramIndex::hashOf(first_copy->getHash(), second_copy->getHash());
+
+        Symbol * location = dictionary? dictionary->findDigram(*first_copy, *second_copy, hash) : nullptr;
+        if(!location) location = digram_index.find(*first_copy, *second_copy, hash);
+        if(!location) return nullptr;
+
+        if(typeid(*(location->prev())) != RuleHeadType) return nullptr;
+        RuleHead * candidate = static_cast<RuleHead*>(location->prev());
+        if(!candidate->getID()) return nullptr;
+
+        //it is identical if the rest of the body matches too:
+        Symbol * ours = location;
+        Symbol * theirs = first;
+        while(typeid(*ours) == typeid(*theirs))
             {
-            std::cout << rule_pair.first << ": ";
-            printList(rule_pair.second, 0);
-            std::cout << std::endl;
+            if(typeid(*ours) == RuleTailType) return candidate;
+            if(typeid(*ours) == RuleSymbolType)
+                {
+                if(static_cast<RuleSymbol*>(ours)->getRule() != mappedRule(theirs, mapped)) return nullptr;
+                }
+            else if(!ours->isEqual(*theirs)) return nullptr;
+
+            ours = ours->next();
+            theirs = theirs->next();
             }
+        return nullptr;
         }
 
-    template<typename Type>
-    void Sequitur<Type>::printAll() const
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::remapRuleSymbols(RuleHead * rule, const RuleMap & mapped)
         {
-        //print out rules:
-        for(const auto & rule_pair : rule_index )
+        for(Symbol * item = rule->next(); typeid(*item) != RuleTailType; item = item->next())
             {
-            std::cout << rule_pair.first << ": ";
-            printList(rule_pair.second, 0);
-            std::cout << std::endl;
+            if(typeid(*item) != RuleSymbolType) continue;
+
+            RuleSymbol * rule_symbol = static_cast<RuleSymbol*>(item);
+            RuleHead * target = mappedRule(rule_symbol, mapped);
+
+            //dictionary rule counts were kept by the other grammar:
+            if(isDictionaryRule(target->getID()))
+                {
+                incrementRule(target);
+                }
+            //kept rules keep their count, but have a new ID to hash by:
+            else if(target == rule_symbol->getRule())
+                {
+                rule_symbol->updateHash();
+                }
+            //anything else now points to one of our rules:
+            else
+                {
+                item = item->prev()->insertAfter(target->makeRuleSymbol().release());
+                rule_symbol->unlink();
+                delete rule_symbol;
+                incrementRule(target);
+                }
             }
+        }
 
-        printDigramIndex();
-        std::cout << std::endl;
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::inlineShortRules()
+        {
+        auto is_short = [this](const RuleHead * rule)
+            {
+            return rule->getID() && !isDictionaryRule(rule->getID()) && rule->next()->next() == rule->getTail();
+            };
+
+        //inlining can give us new digrams, and so new short rules:
+        while(short_rules_made)
+            {
+            short_rules_made = false;
+
+            std::vector<RuleHead*> short_rules;
+            for(const auto & rule_pair : rule_index)
+                {
+                RuleHead * rule = static_cast<RuleHead*>(rule_pair.second);
+                if(is_short(rule)) short_rules.push_back(rule);
+                }
+
+            //swap uses of them out everywhere but in other short rules:
+            for(const auto & rule_pair : rule_index)
+                {
+                RuleHead * rule = static_cast<RuleHead*>(rule_pair.second);
+                if(is_short(rule) || isDictionaryRule(rule_pair.first)) continue;
+
+                Symbol * item = rule->next();
+                while(typeid(*item) != RuleTailType)
+                    {
+                    //what we inline may be a use of a short rule too, so look again:
+                    if(typeid(*item) == RuleSymbolType && is_short(static_cast<RuleSymbol*>(item)->getRule()))
+                        item = inlineShortRule(item);
+                    else item = item->next();
+                    }
+                }
+
+            //now only other short rules use them, so they can all go:
+            for(RuleHead * rule : short_rules)
+                {
+                Symbol * item = rule->next();
+                decrementIfRule(item);
+                observer.ruleRemoved(rule);
+                rule_index.erase(rule->getID());
+                id_generator.free(rule->getID());
+
+                item->unlink();
+                releaseSymbol(item);
+                delete rule->getTail();
+                delete rule;
+                }
+
+            processLinks();
+            }
+        }
+
+    template<typename Type, typename Observer>
+    Symbol * Sequitur<Type, Observer>::inlineShortRule(Symbol * use)
+        {
+        RuleHead * rule = static_cast<RuleSymbol*>(use)->getRule();
+        Symbol * before = use->prev();
+
+        removeDigramFromIndex(before);
+        removeDigramFromIndex(use);
+
+        Symbol * copy = before->insertAfter(rule->next()->clone().release());
+        if(use->hasFlag(Symbol::InStart)) copy->setFlag(Symbol::InStart);
+        incrementIfRule(copy);
+        decrementRule(rule);
+
+        use->unlink();
+        releaseSymbol(use);
+        observer.ruleInlined(rule, copy, copy);
+
+        if(typeid(*(copy->next())) != RuleTailType) queueLink(copy);
+        if(typeid(*before) != RuleHeadType) queueLink(before);
+        return copy;
         }
 
-    template<typename Type>
-    void Sequitur<Type>::printDigramIndex() const
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::queueExpansion(Symbol * potential_rule)
         {
-        for(auto & i : digram_index)
+        //only rules used once need looking at, and each symbol only needs queueing once:
+        if(typeid(*potential_rule) != RuleSymbolType) return;
+        if(isDictionaryRule(static_cast<RuleSymbol*>(potential_rule)->getID())) return;
+        if(static_cast<RuleSymbol*>(potential_rule)->getCount() != 1) return;
+        if(potential_rule->hasFlag(Symbol::QueuedExpansion)) return;
+
+        potential_rule->setFlag(Symbol::QueuedExpansion);
+        pending_expansions.push_back(potential_rule);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::processExpansions()
+        {
+        //expanding can queue further rules, so go until empty:
+        while(!pending_expansions.empty())
             {
-            printList(i.second, 2);
-            std::cout << ", ";
+            Symbol * potential_rule = pending_expansions.back();
+            pending_expansions.pop_back();
+            potential_rule->clearFlag(Symbol::QueuedExpansion);
+
+            //released symbols have been removed from the grammar already:
+            if(potential_rule->hasFlag(Symbol::Released)) continue;
+
+            //the count may have gone back up since it was queued:
+            expandRuleIfNecessary(potential_rule);
+            processLinks();
             }
-        std::cout << std::endl;
+
+        freeReleased();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::releaseSymbol(Symbol * item)
+        {
+        //symbols in a queue must outlive it; we flag them instead:
+        if(item->hasFlag(Symbol::QueuedLink) || item->hasFlag(Symbol::QueuedExpansion))
+            {
+            item->setFlag(Symbol::Released);
+            released_symbols.push_back(item);
+            }
+        else delete item;
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::freeReleased()
+        {
+        //while expansions are pending, released symbols may still be queued:
+        if(!pending_links.empty() || !pending_expansions.empty()) return;
+
+        for(Symbol * item : released_symbols) delete item;
+        released_symbols.clear();
         }
 
 
@@ -642,40 +1687,40 @@ namespace jw
     //### Sequitur Iterator Class ###
     //###############################
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    typename Sequitur<Type>::const_value_type &
-    Sequitur<Type>::SequiturIter<ChildIter>::operator*()
+    typename Sequitur<Type, Observer>::const_value_type &
+    Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator*()
         {
         return static_cast<const Value*>(current_item)->getValue();
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    typename Sequitur<Type>::const_value_type *
-    Sequitur<Type>::SequiturIter<ChildIter>::operator->()
+    typename Sequitur<Type, Observer>::const_value_type *
+    Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator->()
         {
         return &(static_cast<const Value*>(current_item)->getValue());
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    bool Sequitur<Type>::SequiturIter<ChildIter>::operator==(const ChildIter & other) const
+    bool Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator==(const ChildIter & other) const
         {
         return current_item == other.current_item &&
                 pointer_stack == other.pointer_stack;
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    bool Sequitur<Type>::SequiturIter<ChildIter>::operator!=(const ChildIter & other) const
+    bool Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator!=(const ChildIter & other) const
         {
         return !(*this == other);
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    const Symbol * Sequitur<Type>::SequiturIter<ChildIter>::resolveForward(const Symbol * in)
+    const Symbol * Sequitur<Type, Observer>::SequiturIter<ChildIter>::resolveForward(const Symbol * in)
         {
         const std::type_info & type = typeid(*in);
         const Symbol * output;
@@ -707,9 +1752,9 @@ namespace jw
         return output;
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    const Symbol * Sequitur<Type>::SequiturIter<ChildIter>::resolveBackward(const Symbol * in)
+    const Symbol * Sequitur<Type, Observer>::SequiturIter<ChildIter>::resolveBackward(const Symbol * in)
         {
         const std::type_info & type = typeid(*in);
         const Symbol * output;
@@ -741,34 +1786,34 @@ namespace jw
         return output;
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    ChildIter& Sequitur<Type>::SequiturIter<ChildIter>::operator++()
+    ChildIter& Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator++()
         {
         this->forward();
         return *static_cast<ChildIter*>(this);
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    ChildIter Sequitur<Type>::SequiturIter<ChildIter>::operator++(int)
+    ChildIter Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator++(int)
         {
         ChildIter tmp(*static_cast<ChildIter*>(this));
         this->forward();
         return tmp;
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    ChildIter & Sequitur<Type>::SequiturIter<ChildIter>::operator--()
+    ChildIter & Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator--()
         {
         this->backward();
         return *static_cast<ChildIter*>(this);
         }
 
-    template<typename Type>
+    template<typename Type, typename Observer>
     template<typename ChildIter>
-    ChildIter Sequitur<Type>::SequiturIter<ChildIter>::operator--(int)
+    ChildIter Sequitur<Type, Observer>::SequiturIter<ChildIter>::operator--(int)
         {
         ChildIter tmp(*static_cast<ChildIter*>(this));
         this->backward();
@@ -779,30 +1824,42 @@ namespace jw
     // ### function definitions for forward and reverse iterator: ###
     // ##############################################################
 
-    template<typename Type>
-    void Sequitur<Type>::ForwardIter::forward()
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::ForwardIter::forward()
         {
         this->current_item = this->resolveForward(this->current_item->next());
         }
 
-    template<typename Type>
-    void Sequitur<Type>::ForwardIter::backward()
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::ForwardIter::backward()
         {
         this->current_item = this->resolveBackward(this->current_item->prev());
         }
 
-    template<typename Type>
-    void Sequitur<Type>::ReverseIter::forward()
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::ReverseIter::forward()
         {
         this->current_item = this->resolveBackward(this->current_item->prev());
         }
 
-    template<typename Type>
-    void Sequitur<Type>::ReverseIter::backward()
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::ReverseIter::backward()
         {
         this->current_item = this->resolveForward(this->current_item->next());
         }
 
 
     }//end of jw namespace;
+
+//further containers built on Sequitur:
+#include "sequitur/internedsequitur.hpp"
+#include "sequitur/frozengrammar.hpp"
+#include "sequitur/patternsearch.hpp"
+#include "sequitur/dictionary.hpp"
+#include "sequitur/checkpoint.hpp"
+#include "sequitur/repair.hpp"
+#include "sequitur/exporter.hpp"
+#include "sequitur/latency.hpp"
+#include "sequitur/onlineencoder.hpp"
+
 #endif // SEQUITUR_H
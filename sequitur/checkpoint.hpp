@@ -0,0 +1,423 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// Sequitur::checkpoint() saves a grammar part way through a build, and
+// Sequitur::resume() carries on from it, each going through the file in one
+// sequential pass. Pointers mean nothing to another process, so symbols are
+// written out rule by rule, with digram index entries marked on the symbols
+// they point to, and queued expansions listed in queue order by where their
+// symbols are. The file (in native byte order, as it is for resuming on the
+// same machine rather than for exchange) holds:
+// - a header: magic, version, sizeof(Type), length, expansion batch size, rule
+//   depth limit, and the dictionary rule count and a hash of those rules.
+// - the ID generator: next unused ID, then the free IDs.
+// - a rule table: the ID and content hash of each rule (bar dictionary rules).
+// - the expansion queue: how many are queued, then for each, which symbol it
+//   is, counting across the rule bodies below.
+// - rule bodies, in table order: a tag byte per symbol then its value or rule
+//   ID, and an end tag after each body.
+// - a trailer: the grammar's fingerprint.
+//
+// On resume, each rule's content hash is worked out again from its body and
+// checked against the table, and rule 0's against the fingerprint.
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+
+namespace jw
+    {
+
+    namespace checkpoint_format
+        {
+        const char magic[8] = {'S','E','Q','C','K','P','T','\0'};
+        const std::uint32_t version = 4;
+
+        //tag byte bits written before each symbol:
+        enum Tag: unsigned char
+            {
+            RuleTag = 1,
+            IndexedTag = 2,
+            EndTag = 0xFF
+            };
+        }
+
+    //buffered binary output to a temporary file, moved over path by commit():
+    class CheckpointWriter
+        {
+        public:
+        explicit CheckpointWriter(const std::string & in_path):
+            path(in_path), temp_path(in_path + ".tmp"), out(temp_path, std::ios::binary | std::ios::trunc)
+            {
+            if(!out) throw std::runtime_error("can't open " + temp_path + " for writing.");
+            buffer.reserve(buffer_size);
+            }
+        ~CheckpointWriter()
+            {
+            //a checkpoint we didn't finish shouldn't be left lying around:
+            if(!committed)
+                {
+                out.close();
+                std::remove(temp_path.c_str());
+                }
+            }
+
+        template<typename T>
+        void write(const T & item) { writeBytes(&item, sizeof(T)); }
+
+        void writeBytes(const void * bytes, std::size_t size)
+            {
+            if(buffer.size() + size > buffer_size) flush();
+            const char * start = static_cast<const char*>(bytes);
+            buffer.insert(buffer.end(), start, start + size);
+            }
+
+        //write out anything left, and move the file into place:
+        void commit()
+            {
+            flush();
+            out.close();
+            if(!out) throw std::runtime_error("failed writing " + temp_path + ".");
+            if(std::rename(temp_path.c_str(), path.c_str())) throw std::runtime_error("can't replace " + path + ".");
+            committed = true;
+            }
+
+        private:
+        CheckpointWriter(const CheckpointWriter &)=delete;
+        CheckpointWriter & operator=(const CheckpointWriter &)=delete;
+
+        void flush()
+            {
+            out.write(buffer.data(), buffer.size());
+            if(!out) throw std::runtime_error("failed writing " + temp_path + ".");
+            buffer.clear();
+            }
+
+        static const std::size_t buffer_size = 1 << 20;
+        std::string path;
+        std::string temp_path;
+        std::ofstream out;
+        std::vector<char> buffer;
+        bool committed = false;
+        };
+
+    //buffered binary input, throwing if the file runs out early:
+    class CheckpointReader
+        {
+        public:
+        explicit CheckpointReader(const std::string & in_path):
+            path(in_path), in(in_path, std::ios::binary), buffer(buffer_size)
+            {
+            if(!in) throw std::runtime_error("can't open " + path + " for reading.");
+            }
+
+        template<typename T>
+        T read()
+            {
+            T item;
+            readBytes(&item, sizeof(T));
+            return item;
+            }
+
+        void readBytes(void * bytes, std::size_t size)
+            {
+            char * out = static_cast<char*>(bytes);
+            while(size)
+                {
+                if(position == filled) refill();
+                std::size_t amount = std::min(size, filled - position);
+                std::memcpy(out, buffer.data() + position, amount);
+                position += amount;
+                out += amount;
+                size -= amount;
+                }
+            }
+
+        const std::string & getPath() const { return path; }
+
+        private:
+        CheckpointReader(const CheckpointReader &)=delete;
+        CheckpointReader & operator=(const CheckpointReader &)=delete;
+
+        void refill()
+            {
+            in.read(buffer.data(), buffer.size());
+            filled = in.gcount();
+            position = 0;
+            if(!filled) throw std::runtime_error(path + " ends early.");
+            }
+
+        static const std::size_t buffer_size = 1 << 20;
+        std::string path;
+        std::ifstream in;
+        std::vector<char> buffer;
+        std::size_t position = 0;
+        std::size_t filled = 0;
+        };
+
+    //hash of a dictionary's rules, so we know a grammar resumes with the right one:
+    template<typename Type>
+    std::uint64_t dictionaryHash(const Dictionary<Type> * dictionary)
+        {
+        ContentHash out;
+        if(dictionary)
+            {
+            for(const auto & rule_pair : dictionary->getRules())
+                out.append(static_cast<const RuleHead*>(rule_pair.second)->getContentHash());
+            }
+        return out.getValue();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::checkpoint(const std::string & path) const
+        {
+        static_assert(std::is_trivially_copyable<Type>::value, "checkpoint() needs a trivially copyable Type.");
+        using namespace checkpoint_format;
+
+        CheckpointWriter out(path);
+        out.writeBytes(magic, sizeof(magic));
+        out.write<std::uint32_t>(version);
+        out.write<std::uint32_t>(sizeof(Type));
+        out.write<std::uint64_t>(length);
+        out.write<std::uint32_t>(expansion_batch);
+        out.write<std::uint32_t>(max_depth);
+        out.write<std::uint32_t>(dictionary_rules);
+        out.write<std::uint64_t>(dictionaryHash(dictionary.get()));
+
+        out.write<std::uint32_t>(id_generator.nextUnused());
+        out.write<std::uint32_t>(id_generator.freeIds().size());
+        for(unsigned int id : id_generator.freeIds()) out.write<std::uint32_t>(id);
+
+        //dictionary rules come back from the dictionary:
+        std::vector<RuleHead*> rules;
+        for(const auto & rule_pair : rule_index)
+            {
+            if(!isDictionaryRule(rule_pair.first)) rules.push_back(static_cast<RuleHead*>(rule_pair.second));
+            }
+
+        out.write<std::uint32_t>(rules.size());
+        for(const RuleHead * rule : rules)
+            {
+            const ContentHash & content = rule->getContentHash();
+            out.write<std::uint32_t>(rule->getID());
+            out.write<std::uint64_t>(content.getValue());
+            out.write<std::uint64_t>(content.getPower());
+            out.write<std::uint64_t>(content.getLength());
+            }
+
+        //the order expansions are queued in decides the order rules are made in
+        //after resuming, so we find where each queued symbol is in the bodies
+        //(released ones are skipped when the queue is processed, so are left out):
+        std::unordered_map<const Symbol*, std::uint64_t> queued;
+        for(const Symbol * item : pending_expansions)
+            {
+            if(!item->hasFlag(Symbol::Released)) queued[item] = 0;
+            }
+        if(!queued.empty())
+            {
+            std::uint64_t ordinal = 0;
+            for(const RuleHead * rule : rules)
+                {
+                for(const Symbol * item = rule->next(); typeid(*item) != RuleTailType; item = item->next(), ++ordinal)
+                    {
+                    if(item->hasFlag(Symbol::QueuedExpansion)) queued[item] = ordinal;
+                    }
+                }
+            }
+        out.write<std::uint64_t>(queued.size());
+        for(const Symbol * item : pending_expansions)
+            {
+            if(!item->hasFlag(Symbol::Released)) out.write<std::uint64_t>(queued[item]);
+            }
+
+        for(const RuleHead * rule : rules)
+            {
+            for(const Symbol * item = rule->next(); typeid(*item) != RuleTailType; item = item->next())
+                {
+                unsigned char tag = 0;
+                if(typeid(*(item->next())) != RuleTailType && digram_index.find(item) == item) tag |= IndexedTag;
+
+                if(typeid(*item) == RuleSymbolType)
+                    {
+                    out.write<unsigned char>(tag | RuleTag);
+                    out.write<std::uint32_t>(static_cast<const RuleSymbol*>(item)->getID());
+                    }
+                else
+                    {
+                    out.write<unsigned char>(tag);
+                    out.writeBytes(&(static_cast<const Value*>(item)->getValue()), sizeof(Type));
+                    }
+                }
+            out.write<unsigned char>(EndTag);
+            }
+
+        out.write<std::uint64_t>(fingerprint().getValue());
+        out.write<std::uint64_t>(fingerprint().getLength());
+        out.commit();
+        }
+
+    template<typename Type, typename Observer>
+    Sequitur<Type, Observer> Sequitur<Type, Observer>::resume(const std::string & path, std::shared_ptr<const Dictionary<Type>> dictionary)
+        {
+        static_assert(std::is_trivially_copyable<Type>::value, "resume() needs a trivially copyable Type.");
+        using namespace checkpoint_format;
+
+        CheckpointReader in(path);
+        char file_magic[sizeof(magic)];
+        in.readBytes(file_magic, sizeof(file_magic));
+        if(std::memcmp(file_magic, magic, sizeof(magic)) || in.read<std::uint32_t>() != version)
+            throw std::runtime_error(path + " is not a checkpoint.");
+        if(in.read<std::uint32_t>() != sizeof(Type))
+            throw std::runtime_error(path + " holds values of another type.");
+
+        Sequitur<Type, Observer> grammar(std::move(dictionary));
+        grammar.length = in.read<std::uint64_t>();
+        grammar.expansion_batch = in.read<std::uint32_t>();
+        std::uint32_t file_max_depth = in.read<std::uint32_t>();
+
+        std::uint32_t file_dictionary_rules = in.read<std::uint32_t>();
+        std::uint64_t file_dictionary_hash = in.read<std::uint64_t>();
+        if(file_dictionary_rules != grammar.dictionary_rules || file_dictionary_hash != dictionaryHash(grammar.dictionary.get()))
+            throw std::runtime_error(path + " needs the dictionary it was primed with.");
+
+        std::uint32_t next_unused = in.read<std::uint32_t>();
+        std::vector<unsigned int> free_ids(in.read<std::uint32_t>());
+        for(unsigned int & id : free_ids) id = in.read<std::uint32_t>();
+        grammar.id_generator = ID(next_unused, std::move(free_ids));
+
+        //make every rule first, so rule symbols have something to point at:
+        std::vector<RuleHead*> rules(in.read<std::uint32_t>());
+        for(RuleHead * & rule : rules)
+            {
+            std::uint32_t id = in.read<std::uint32_t>();
+            std::uint64_t value = in.read<std::uint64_t>();
+            std::uint64_t power = in.read<std::uint64_t>();
+            std::uint64_t content_length = in.read<std::uint64_t>();
+
+            if(id == 0) rule = static_cast<RuleHead*>(grammar.rule_index.at(0));
+            else if(grammar.rule_index.contains(id)) throw std::runtime_error(path + " is corrupt.");
+            else
+                {
+                RuleTail * rule_tail = new RuleTail();
+                rule = new RuleHead(id, rule_tail);
+                rule->insertAfter(rule_tail);
+                grammar.rule_index.insert(id, rule);
+                }
+            rule->setContentHash(ContentHash(value, power, content_length));
+            }
+
+        //where each queued expansion goes in the queue, by which symbol it is:
+        grammar.pending_expansions.resize(in.read<std::uint64_t>(), nullptr);
+        std::unordered_map<std::uint64_t, std::size_t> queue_positions;
+        for(std::size_t position = 0; position < grammar.pending_expansions.size(); ++position)
+            {
+            if(!queue_positions.insert({in.read<std::uint64_t>(), position}).second) throw std::runtime_error(path + " is corrupt.");
+            }
+
+        //now fill them in; counts are rebuilt from the rule symbols we make:
+        std::vector<Symbol*> indexed;
+        std::uint64_t ordinal = 0;
+        for(RuleHead * rule : rules)
+            {
+            RuleTail * rule_tail = rule->getTail();
+            unsigned char tag;
+            while((tag = in.read<unsigned char>()) != EndTag)
+                {
+                Symbol * item;
+                if(tag & RuleTag)
+                    {
+                    std::uint32_t id = in.read<std::uint32_t>();
+                    if(!grammar.rule_index.contains(id)) throw std::runtime_error(path + " is corrupt.");
+                    RuleHead * target = static_cast<RuleHead*>(grammar.rule_index.at(id));
+                    item = target->makeRuleSymbol().release();
+                    grammar.incrementRule(target);
+                    }
+                else
+                    {
+                    typename std::aligned_storage<sizeof(Type), alignof(Type)>::type raw;
+                    in.readBytes(&raw, sizeof(Type));
+                    item = new Value(*reinterpret_cast<const Type*>(&raw));
+                    }
+                rule_tail->insertBefore(item);
+
+                if(tag & IndexedTag) indexed.push_back(item);
+                auto queued = queue_positions.find(ordinal++);
+                if(queued != queue_positions.end())
+                    {
+                    item->setFlag(Symbol::QueuedExpansion);
+                    grammar.pending_expansions[queued->second] = item;
+                    }
+                }
+            }
+        for(Symbol * item : grammar.pending_expansions)
+            {
+            if(!item) throw std::runtime_error(path + " is corrupt.");
+            }
+
+        //work each rule's content hash out again from its body, after those of
+        //the rules it uses, so a damaged body can't pass for the saved one:
+        std::unordered_map<const RuleHead*, bool> finished;
+        std::vector<std::pair<const RuleHead*, const Symbol*>> stack;
+        for(const RuleHead * rule : rules)
+            {
+            if(finished.count(rule)) continue;
+            finished[rule] = false;
+            stack.emplace_back(rule, rule->next());
+            while(!stack.empty())
+                {
+                const RuleHead * current = stack.back().first;
+                const Symbol * item = stack.back().second;
+                if(item != current->getTail())
+                    {
+                    stack.back().second = item->next();
+                    if(typeid(*item) != grammar.RuleSymbolType) continue;
+                    const RuleHead * used = static_cast<const RuleSymbol*>(item)->getRule();
+                    if(grammar.isDictionaryRule(used->getID())) continue;
+
+                    //a rule still being worked out uses itself:
+                    auto state = finished.find(used);
+                    if(state == finished.end())
+                        {
+                        finished[used] = false;
+                        stack.emplace_back(used, used->next());
+                        }
+                    else if(!state->second) throw std::runtime_error(path + " is corrupt.");
+                    continue;
+                    }
+
+                ContentHash content;
+                for(item = current->next(); item != current->getTail(); item = item->next())
+                    content.append(grammar.symbolContent(item));
+                if(content != current->getContentHash()) throw std::runtime_error(path + " is corrupt.");
+                finished[current] = true;
+                stack.pop_back();
+                }
+            }
+
+        for(Symbol * item : indexed) grammar.digram_index.insert(item);
+
+        //rule depths (and, under a limit, which symbols are in rule 0) are worked
+        //out again rather than saved:
+        grammar.setMaxRuleDepth(file_max_depth);
+
+        std::uint64_t fingerprint_value = in.read<std::uint64_t>();
+        std::uint64_t fingerprint_length = in.read<std::uint64_t>();
+        if(grammar.fingerprint().getValue() != fingerprint_value || grammar.fingerprint().getLength() != fingerprint_length
+            || fingerprint_length != grammar.length)
+            throw std::runtime_error(path + " is corrupt.");
+
+        return grammar;
+        }
+
+    }//end jw namespace
+
+#endif // CHECKPOINT_HPP
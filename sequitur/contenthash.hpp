@@ -0,0 +1,104 @@
+#ifndef CONTENTHASH_HPP
+#define CONTENTHASH_HPP
+
+// Hash of the sequence a rule expands to. It is a polynomial hash mod the
+// prime 2^61-1, which composes: hash(ab) = hash(a) * base^len(b) + hash(b).
+// So a rule's hash comes straight from the hashes of the symbols in its body,
+// Merkle style, and as Sequitur never changes what a rule expands to (only how
+// its body is put together), it never needs updating once the rule is made.
+//
+// Two grammars of the same sequence share a hash however their rules ended up,
+// so comparing them (or finding duplicates among many) needs no expanding.
+
+#include <cstdint>
+
+namespace jw
+    {
+
+    class ContentHash
+        {
+        public:
+
+        //the empty sequence:
+        ContentHash(): value(0), power(1), length(0) {}
+        //from the parts of a hash saved earlier:
+        ContentHash(std::uint64_t in_value, std::uint64_t in_power, std::uint64_t in_length):
+            value(in_value), power(in_power), length(in_length) {}
+
+        //a single value, given its full (not truncated) hash, mixed so that
+        //values differing only in their high bits don't end up alike:
+        static ContentHash ofValue(std::uint64_t value_hash)
+            {
+            value_hash ^= value_hash >> 30;
+            value_hash *= 0xbf58476d1ce4e5b9ull;
+            value_hash ^= value_hash >> 27;
+            value_hash *= 0x94d049bb133111ebull;
+            value_hash ^= value_hash >> 31;
+
+            //reduced to 1..2^61-2, so no value hashes the same as nothing:
+            ContentHash out;
+            out.value = value_hash % (modulus - 1) + 1;
+            out.power = base;
+            out.length = 1;
+            return out;
+            }
+
+        //extend to the hash of this sequence followed by other:
+        ContentHash & append(const ContentHash & other)
+            {
+            value = addMod(mulMod(value, other.power), other.value);
+            power = mulMod(power, other.power);
+            length += other.length;
+            return *this;
+            }
+
+        std::uint64_t getValue() const { return value; }
+        std::uint64_t getPower() const { return power; }
+        std::uint64_t getLength() const { return length; }
+
+        bool operator==(const ContentHash & other) const
+            {
+            return value == other.value && length == other.length;
+            }
+        bool operator!=(const ContentHash & other) const
+            {
+            return !(*this == other);
+            }
+
+        private:
+
+        static const std::uint64_t modulus = (std::uint64_t(1) << 61) - 1;
+        static const std::uint64_t base = 0x0a3c5f1e9b7d2c47;
+
+        static std::uint64_t addMod(std::uint64_t a, std::uint64_t b)
+            {
+            std::uint64_t out = a + b;
+            return out >= modulus? out - modulus : out;
+            }
+
+        //a*b mod 2^61-1 in 64 bit arithmetic, using 2^61 = 1 (mod 2^61-1) to
+        //fold the high bits back in. a and b split into 31 bit halves:
+        static std::uint64_t mulMod(std::uint64_t a, std::uint64_t b)
+            {
+            const std::uint64_t low_mask = (std::uint64_t(1) << 31) - 1;
+            const std::uint64_t mid_mask = (std::uint64_t(1) << 30) - 1;
+
+            std::uint64_t a_high = a >> 31, a_low = a & low_mask;
+            std::uint64_t b_high = b >> 31, b_low = b & low_mask;
+            std::uint64_t mid = a_high * b_low + a_low * b_high;
+
+            std::uint64_t out = ((a_high * b_high) << 1)
+                              + (mid >> 30) + ((mid & mid_mask) << 31)
+                              + a_low * b_low;
+            out = (out & modulus) + (out >> 61);
+            return out >= modulus? out - modulus : out;
+            }
+
+        std::uint64_t value;
+        std::uint64_t power;
+        std::uint64_t length;
+        };
+
+    }//end jw namespace
+
+#endif // CONTENTHASH_HPP
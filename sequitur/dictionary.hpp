@@ -0,0 +1,203 @@
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// A Dictionary<Type> is a read-only set of rules taken from a grammar built
+// earlier, which new Sequitur instances can be primed with so that they reuse
+// structure from the start (much like a zstd dictionary). Rules are split up
+// so that every dictionary rule has exactly two symbols. This means a digram
+// matching one always matches the whole rule, so priming never needs to
+// change a dictionary rule; it just gets used.
+//
+// Dictionary rules take IDs 1..ruleCount(), and Sequitur leaves them alone
+// even if they end up used once or not at all.
+//
+// Nothing in a Dictionary changes once it is built, so any number of
+// grammars (on any number of threads) can share one. They point at its rules
+// and look digrams up in its index rather than holding copies, keeping only
+// their own use count for each dictionary rule.
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace jw
+    {
+
+    template<typename Type>
+    class Dictionary
+        {
+        public:
+        using Value = ValueSymbol<Type>;
+
+        //take every rule but rule 0 from the grammar:
+        template<typename Observer>
+        explicit Dictionary(const Sequitur<Type, Observer> & grammar);
+        ~Dictionary();
+
+        //number of rules in the dictionary:
+        unsigned ruleCount() const { return rule_index.size(); }
+
+        //rules for inspection; IDs run from 1 to ruleCount():
+        const RuleIndex & getRules() const { return rule_index; }
+
+        //the first symbol of the rule with this digram, or nullptr if none:
+        Symbol * findDigram(const Symbol & first, const Symbol & second, std::uint64_t hash) const;
+
+        private:
+        Dictionary(const Dictionary &)=delete;
+        Dictionary & operator=(const Dictionary &)=delete;
+
+        //make an empty rule with the next free ID:
+        RuleHead * makeRule();
+
+        //append a copy of item to the end of rule, pointing rule symbols to our rules:
+        void appendCopy(RuleHead * rule, const Symbol * item);
+
+        //hash of what a symbol in the source grammar expands to:
+        static ContentHash contentOf(const Symbol * item);
+
+        ID id_generator;
+        RuleIndex rule_index;
+        typename Sequitur<Type>::DigramIndex digram_index;
+        //the rule each source rule ended up as, by source ID:
+        std::vector<RuleHead*> source_rules;
+        };
+
+    template<typename Type>
+    template<typename Observer>
+    Dictionary<Type>::Dictionary(const Sequitur<Type, Observer> & grammar): id_generator(1)
+        {
+        const RuleIndex & source = grammar.getRules();
+
+        //make the rule that each source rule will end up as first, so that rule
+        //symbols have something to point to as we copy bodies across:
+        for(const auto & rule_pair : source)
+            {
+            if(!rule_pair.first) continue;
+            if(rule_pair.first >= source_rules.size()) source_rules.resize(rule_pair.first+1, nullptr);
+            source_rules[rule_pair.first] = makeRule();
+            }
+
+        //now split each body [a b c d] into [a b], [[a b] c], [[[a b] c] d]:
+        for(const auto & rule_pair : source)
+            {
+            if(!rule_pair.first) continue;
+
+            const Symbol * item = rule_pair.second->next();
+            const Symbol * last = static_cast<const RuleHead*>(rule_pair.second)->getTail()->prev();
+            RuleHead * partial = nullptr;
+            ContentHash content;
+            while(item != last)
+                {
+                RuleHead * next_partial = (item->next() == last)? source_rules[rule_pair.first] : makeRule();
+
+                if(partial)
+                    {
+                    next_partial->getTail()->insertBefore(partial->makeRuleSymbol().release());
+                    partial->increment();
+                    }
+                else
+                    {
+                    appendCopy(next_partial, item);
+                    content = contentOf(item);
+                    }
+                item = item->next();
+                appendCopy(next_partial, item);
+                next_partial->setContentHash(content.append(contentOf(item)));
+                partial = next_partial;
+                }
+            }
+
+        //every rule is now a single digram for grammars to look up (should two
+        //rules share one, the first is used):
+        for(const auto & rule_pair : rule_index)
+            {
+            Symbol * first = rule_pair.second->next();
+            digram_index.insert(first);
+            }
+
+        //splitting bodies up makes rules deeper, and grammars with a rule depth
+        //limit need to know by how much:
+        rule_index.setDepths(1);
+        }
+
+    template<typename Type>
+    Dictionary<Type>::~Dictionary()
+        {
+        for(const auto & rule_pair : rule_index)
+            {
+            rule_pair.second->forUntil([](Symbol * item)
+                {
+                delete item;
+                return true;
+                });
+            }
+        }
+
+    template<typename Type>
+    Symbol * Dictionary<Type>::findDigram(const Symbol & first, const Symbol & second, std::uint64_t hash) const
+        {
+        return digram_index.find(first, second, hash);
+        }
+
+    template<typename Type>
+    RuleHead * Dictionary<Type>::makeRule()
+        {
+        RuleTail * rule_tail = new RuleTail();
+        RuleHead * rule_head = new RuleHead(id_generator.get(), rule_tail);
+        rule_head->insertAfter(rule_tail);
+        rule_index.insert(rule_head->getID(), rule_head);
+        return rule_head;
+        }
+
+    template<typename Type>
+    void Dictionary<Type>::appendCopy(RuleHead * rule, const Symbol * item)
+        {
+        Symbol * copy;
+        if(typeid(*item) == typeid(RuleSymbol))
+            {
+            RuleHead * target = source_rules[static_cast<const RuleSymbol*>(item)->getID()];
+            target->increment();
+            copy = target->makeRuleSymbol().release();
+            }
+        else copy = item->clone().release();
+
+        rule->getTail()->insertBefore(copy);
+        }
+
+    template<typename Type>
+    ContentHash Dictionary<Type>::contentOf(const Symbol * item)
+        {
+        if(typeid(*item) == typeid(RuleSymbol)) return static_cast<const RuleSymbol*>(item)->getRule()->getContentHash();
+        else return ContentHash::ofValue(static_cast<const ValueSymbol<Type>*>(item)->getContentHash());
+        }
+
+    //Sequitur members needing the complete Dictionary live here:
+    template<typename Type, typename Observer>
+    Sequitur<Type, Observer>::Sequitur(std::shared_ptr<const Dictionary<Type>> in_dictionary):
+        dictionary(std::move(in_dictionary))
+        {
+        makeStartRule();
+        primeFromDictionary();
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::primeFromDictionary()
+        {
+        if(!dictionary) return;
+
+        //share the dictionary's rules, keeping their IDs:
+        dictionary_rules = dictionary->ruleCount();
+        for(const auto & rule_pair : dictionary->getRules())
+            rule_index.insert(rule_pair.first, rule_pair.second);
+        dictionary_counts.assign(dictionary_rules+1, 0);
+
+        //our own rules are numbered after the dictionary's:
+        id_generator = ID(dictionary_rules+1);
+        }
+
+    }//end jw namespace
+
+#endif // DICTIONARY_HPP
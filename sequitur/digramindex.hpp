@@ -0,0 +1,260 @@
+#ifndef DIGRAMINDEX_HPP
+#define DIGRAMINDEX_HPP
+
+// Index from each digram to where it appears. An open addressed table with
+// linear probing: one flat array of slots, each holding a digram's hash, a
+// copy of its two symbols and where it is. Looking a digram up compares the
+// symbols in place, so nothing is copied unless a digram is added, and as the
+// slot for a digram depends only on its hash, the slot can be fetched into
+// cache (prefetch()) well before the digram is looked up.
+//
+// Slots are freed by shifting later entries back rather than leaving
+// tombstones, so lookups never slow down as digrams come and go. Iterating
+// visits where each digram is (Symbol*), in no particular order.
+//
+// Growing the table puts every entry back, all in one call; given a histogram
+// (recordGrowth()), how long each time takes is recorded in it.
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+#include "symbols.hpp"
+#include "histogram.hpp"
+
+namespace jw
+    {
+
+    class DigramIndex
+        {
+        struct Slot
+            {
+            std::uint64_t hash;
+            Symbol * first;
+            Symbol * second;
+            //nullptr if the slot is empty:
+            Symbol * location;
+            };
+
+        public:
+        class const_iterator
+            {
+            public:
+            const_iterator(const std::vector<Slot> * in_slots, std::size_t in_position):
+                slots(in_slots), position(in_position)
+                {
+                skipEmpty();
+                }
+
+            Symbol * operator* () const { return (*slots)[position].location; }
+
+            bool operator==(const const_iterator & other) const { return position == other.position; }
+            bool operator!=(const const_iterator & other) const { return !(*this == other); }
+
+            const_iterator & operator++()
+                {
+                ++position;
+                skipEmpty();
+                return *this;
+                }
+
+            private:
+            void skipEmpty()
+                {
+                while(position < slots->size() && !(*slots)[position].location) ++position;
+                }
+
+            const std::vector<Slot> * slots;
+            std::size_t position;
+            };
+
+        DigramIndex() {}
+
+        //moving leaves the other index empty:
+        DigramIndex(DigramIndex && other):
+            slots(std::move(other.slots)), shift(other.shift), used(other.used), growth(other.growth)
+            {
+            other.slots.clear();
+            other.shift = 64;
+            other.used = 0;
+            other.growth = nullptr;
+            }
+        DigramIndex & operator=(DigramIndex && other)
+            {
+            if(this == &other) return *this;
+            clear();
+            slots = std::move(other.slots);
+            shift = other.shift;
+            used = other.used;
+            growth = other.growth;
+            other.slots.clear();
+            other.shift = 64;
+            other.used = 0;
+            other.growth = nullptr;
+            return *this;
+            }
+        DigramIndex(const DigramIndex &)=delete;
+        DigramIndex & operator=(const DigramIndex &)=delete;
+
+        ~DigramIndex()
+            {
+            clear();
+            }
+
+        //hash of a digram from the hashes of its two symbols:
+        static const std::uint64_t hash_multiplier = 0x9E3779B97F4A7C15ull;
+        static std::uint64_t hashOf(unsigned int first, unsigned int second)
+            {
+            return ((std::uint64_t(first) << 32) | second) * hash_multiplier;
+            }
+        static std::uint64_t hashOf(const Symbol * first)
+            {
+            return hashOf(first->getHash(), first->next()->getHash());
+            }
+
+        //where the digram [first second] is, or nullptr if it isn't indexed:
+        Symbol * find(const Symbol & first, const Symbol & second, std::uint64_t hash) const
+            {
+            if(slots.empty()) return nullptr;
+            return slots[findSlot(first, second, hash)].location;
+            }
+        Symbol * find(const Symbol * first) const
+            {
+            return find(*first, *(first->next()), hashOf(first));
+            }
+
+        //index the digram starting at location unless it already is, returning
+        //where it is indexed (location itself if it was just added):
+        Symbol * insert(Symbol * location, std::uint64_t hash)
+            {
+            if((used+1)*10 > slots.size()*7) grow();
+            Slot & slot = slots[findSlot(*location, *(location->next()), hash)];
+            if(slot.location) return slot.location;
+
+            slot.hash = hash;
+            slot.first = location->clone().release();
+            slot.second = location->next()->clone().release();
+            slot.location = location;
+            ++used;
+            return location;
+            }
+        Symbol * insert(Symbol * location)
+            {
+            return insert(location, hashOf(location));
+            }
+
+        //index the digram starting at location, wherever it was before:
+        void assign(Symbol * location)
+            {
+            Symbol * indexed = insert(location);
+            if(indexed != location) slots[findSlot(*location, *(location->next()), hashOf(location))].location = location;
+            }
+
+        //forget the digram starting at location, if that's where it is indexed:
+        void erase(Symbol * location)
+            {
+            if(slots.empty()) return;
+            std::size_t hole = findSlot(*location, *(location->next()), hashOf(location));
+            if(slots[hole].location != location) return;
+            release(slots[hole]);
+
+            //shift back any entries that probed past the hole, so no lookup
+            //stops short at it:
+            const std::size_t mask = slots.size()-1;
+            for(std::size_t position = (hole+1) & mask; slots[position].location; position = (position+1) & mask)
+                {
+                std::size_t home = slots[position].hash >> shift;
+                if(((position - home) & mask) >= ((position - hole) & mask))
+                    {
+                    slots[hole] = slots[position];
+                    hole = position;
+                    }
+                }
+            slots[hole].location = nullptr;
+            --used;
+            }
+
+        //start fetching the slot a digram with this hash would be in:
+        void prefetch(std::uint64_t hash) const
+            {
+        #if defined(__GNUC__) || defined(__clang__)
+            if(!slots.empty()) __builtin_prefetch(&slots[hash >> shift]);
+        #else
+            (void)hash;
+        #endif
+            }
+
+        //keeps hold of the table, for reuse:
+        void clear()
+            {
+            for(Slot & slot : slots) if(slot.location) release(slot);
+            used = 0;
+            }
+
+        std::size_t size() const { return used; }
+        bool empty() const { return !used; }
+
+        //record how many nanoseconds each growth takes in histogram (nullptr to stop):
+        void recordGrowth(LatencyHistogram * histogram) { growth = histogram; }
+
+        const_iterator begin() const { return const_iterator(&slots, 0); }
+        const_iterator end() const { return const_iterator(&slots, slots.size()); }
+
+        private:
+        //the slot holding [first second], or the empty one it would go in:
+        std::size_t findSlot(const Symbol & first, const Symbol & second, std::uint64_t hash) const
+            {
+            const std::size_t mask = slots.size()-1;
+            std::size_t position = hash >> shift;
+            while(slots[position].location)
+                {
+                const Slot & slot = slots[position];
+                if(slot.hash == hash && slot.first->isEqual(first) && slot.second->isEqual(second)) break;
+                position = (position+1) & mask;
+                }
+            return position;
+            }
+
+        //free the copies held in a slot, leaving it empty:
+        static void release(Slot & slot)
+            {
+            delete slot.first;
+            delete slot.second;
+            slot.location = nullptr;
+            }
+
+        //double the table (a power of two, from 16) and put every entry back:
+        void grow()
+            {
+            std::chrono::steady_clock::time_point start;
+            if(growth) start = std::chrono::steady_clock::now();
+
+            std::vector<Slot> old_slots(slots.empty()? 16 : slots.size()*2, Slot{0, nullptr, nullptr, nullptr});
+            old_slots.swap(slots);
+            shift = 64;
+            for(std::size_t size = slots.size(); size > 1; size >>= 1) --shift;
+
+            const std::size_t mask = slots.size()-1;
+            for(const Slot & slot : old_slots)
+                {
+                if(!slot.location) continue;
+                std::size_t position = slot.hash >> shift;
+                while(slots[position].location) position = (position+1) & mask;
+                slots[position] = slot;
+                }
+
+            if(growth) growth->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            }
+
+        std::vector<Slot> slots;
+        //slot index is the top bits of the hash:
+        unsigned int shift = 64;
+        std::size_t used = 0;
+        LatencyHistogram * growth = nullptr;
+        };
+
+    } //end jw namespace
+
+#endif // DIGRAMINDEX_HPP
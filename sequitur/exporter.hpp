@@ -0,0 +1,425 @@
+#ifndef EXPORTER_HPP
+#define EXPORTER_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// Writing grammars out, as text (the format printRules() uses), JSON, or a
+// Graphviz DOT digraph. Everything goes through an OutputBuffer, which gathers
+// output in one large buffer and hands it to a file descriptor, string or
+// ostream only when full, formatting integers itself rather than going through
+// iostreams. Rules are written in ID order, so dumps of the same grammar diff
+// cleanly.
+//
+// Values are written as iostreams would for text; char values are written
+// as strings in JSON and DOT (escaping anything unprintable), other numbers
+// as numbers, and any other Type through its operator<<.
+
+#include <string>
+#include <ostream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <unistd.h>
+#include <cerrno>
+
+namespace jw
+    {
+
+    class OutputBuffer
+        {
+        public:
+        //write to an open file descriptor (which is left open):
+        explicit OutputBuffer(int in_fd): fd(in_fd) { }
+        //append to a string:
+        explicit OutputBuffer(std::string & out): string_out(&out) { }
+        //write to a stream (which is not flushed):
+        explicit OutputBuffer(std::ostream & out): stream_out(&out) { }
+
+        //hands over anything left. Errors can't be thrown from here, so call
+        //flush() first if they matter:
+        ~OutputBuffer()
+            {
+            try { flush(); }
+            catch(...) { }
+            }
+
+        void put(char c)
+            {
+            if(used == buffer_size) flush();
+            buffer[used++] = c;
+            }
+        void write(const char * bytes, std::size_t size)
+            {
+            if(used + size > buffer_size) flush();
+            if(size > buffer_size) sink(bytes, size);
+            else
+                {
+                std::memcpy(buffer.get() + used, bytes, size);
+                used += size;
+                }
+            }
+        void write(const char * text) { write(text, std::strlen(text)); }
+        void write(const std::string & text) { write(text.data(), text.size()); }
+
+        void writeUnsigned(std::uint64_t number)
+            {
+            char digits[20];
+            char * start = digits + sizeof(digits);
+            do
+                {
+                *--start = '0' + number % 10;
+                number /= 10;
+                }
+            while(number);
+            write(start, digits + sizeof(digits) - start);
+            }
+        void writeSigned(std::int64_t number)
+            {
+            if(number < 0)
+                {
+                put('-');
+                writeUnsigned(std::uint64_t(0) - std::uint64_t(number));
+                }
+            else writeUnsigned(number);
+            }
+        //16 lowercase hex digits:
+        void writeHex(std::uint64_t number)
+            {
+            char digits[16];
+            for(int i = 15; i >= 0; --i, number >>= 4) digits[i] = "0123456789abcdef"[number & 0xF];
+            write(digits, sizeof(digits));
+            }
+
+        //hand everything written so far to the sink:
+        void flush()
+            {
+            std::size_t size = used;
+            used = 0;
+            sink(buffer.get(), size);
+            }
+
+        private:
+        OutputBuffer(const OutputBuffer &)=delete;
+        OutputBuffer & operator=(const OutputBuffer &)=delete;
+
+        void sink(const char * bytes, std::size_t size)
+            {
+            if(string_out) string_out->append(bytes, size);
+            else if(stream_out)
+                {
+                stream_out->write(bytes, size);
+                if(!*stream_out) throw std::runtime_error("failed writing to stream.");
+                }
+            else while(size)
+                {
+                ssize_t written = ::write(fd, bytes, size);
+                if(written < 0)
+                    {
+                    if(errno == EINTR) continue;
+                    throw std::runtime_error("failed writing to file descriptor.");
+                    }
+                bytes += written;
+                size -= written;
+                }
+            }
+
+        static const std::size_t buffer_size = 1 << 18;
+        std::unique_ptr<char[]> buffer{new char[buffer_size]};
+        std::size_t used = 0;
+        int fd = -1;
+        std::string * string_out = nullptr;
+        std::ostream * stream_out = nullptr;
+        };
+
+    namespace export_format
+        {
+        enum class Escape { Json, Dot };
+
+        //one byte, escaped for the inside of a quoted JSON or DOT string:
+        inline void writeEscaped(OutputBuffer & out, char c, Escape escape)
+            {
+            unsigned char byte = c;
+            if(c == '"' || c == '\\')
+                {
+                out.put('\\');
+                if(escape == Escape::Dot && c == '\\') out.put('\\');
+                out.put(c);
+                }
+            else if(byte < 0x20 || byte >= 0x7F)
+                {
+                if(escape == Escape::Json) out.write("\\u00");
+                else out.write("\\\\x");
+                out.put("0123456789abcdef"[byte >> 4]);
+                out.put("0123456789abcdef"[byte & 0xF]);
+                }
+            else out.put(c);
+            }
+        inline void writeEscaped(OutputBuffer & out, const std::string & text, Escape escape)
+            {
+            for(char c : text) writeEscaped(out, c, escape);
+            }
+
+        template<typename T>
+        std::string streamed(const T & value)
+            {
+            std::ostringstream out;
+            out << value;
+            return out.str();
+            }
+
+        //as std::cout would write it:
+        inline void writeValue(OutputBuffer & out, char value) { out.put(value); }
+        inline void writeValue(OutputBuffer & out, signed char value) { out.put(value); }
+        inline void writeValue(OutputBuffer & out, unsigned char value) { out.put(value); }
+        inline void writeValue(OutputBuffer & out, bool value) { out.put(value? '1' : '0'); }
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        writeValue(OutputBuffer & out, T value) { out.writeSigned(value); }
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        writeValue(OutputBuffer & out, T value) { out.writeUnsigned(value); }
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        writeValue(OutputBuffer & out, T value)
+            {
+            char text[32];
+            out.write(text, std::snprintf(text, sizeof(text), "%g", double(value)));
+            }
+        template<typename T>
+        typename std::enable_if<!std::is_arithmetic<T>::value>::type
+        writeValue(OutputBuffer & out, const T & value) { out.write(streamed(value)); }
+
+        //as a JSON value:
+        inline void writeJson(OutputBuffer & out, char value)
+            {
+            out.put('"');
+            writeEscaped(out, value, Escape::Json);
+            out.put('"');
+            }
+        inline void writeJson(OutputBuffer & out, signed char value) { writeJson(out, char(value)); }
+        inline void writeJson(OutputBuffer & out, unsigned char value) { writeJson(out, char(value)); }
+        inline void writeJson(OutputBuffer & out, bool value) { out.write(value? "true" : "false"); }
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value>::type
+        writeJson(OutputBuffer & out, T value) { writeValue(out, value); }
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        writeJson(OutputBuffer & out, T value)
+            {
+            if(!std::isfinite(value))
+                {
+                out.write("null");
+                return;
+                }
+            char text[32];
+            out.write(text, std::snprintf(text, sizeof(text), "%.17g", double(value)));
+            }
+        template<typename T>
+        typename std::enable_if<!std::is_arithmetic<T>::value>::type
+        writeJson(OutputBuffer & out, const T & value)
+            {
+            out.put('"');
+            writeEscaped(out, streamed(value), Escape::Json);
+            out.put('"');
+            }
+
+        //inside a quoted DOT label:
+        inline void writeLabel(OutputBuffer & out, char value) { writeEscaped(out, value, Escape::Dot); }
+        inline void writeLabel(OutputBuffer & out, signed char value) { writeEscaped(out, value, Escape::Dot); }
+        inline void writeLabel(OutputBuffer & out, unsigned char value) { writeEscaped(out, value, Escape::Dot); }
+        template<typename T>
+        typename std::enable_if<std::is_arithmetic<T>::value>::type
+        writeLabel(OutputBuffer & out, T value) { writeValue(out, value); }
+        template<typename T>
+        typename std::enable_if<!std::is_arithmetic<T>::value>::type
+        writeLabel(OutputBuffer & out, const T & value) { writeEscaped(out, streamed(value), Escape::Dot); }
+        }
+
+    //Sequitur members needing the complete OutputBuffer live here:
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::writeList(OutputBuffer & out, const Symbol * list, unsigned int number) const
+        {
+        list->forUntil([&](const Symbol * item)
+            {
+            if(typeid(*item) == ValueType)
+                {
+                export_format::writeValue(out, static_cast<const Value*>(item)->getValue());
+                out.put(' ');
+                }
+            else if(typeid(*item) == RuleSymbolType)
+                {
+                out.put('[');
+                out.writeUnsigned(static_cast<const RuleSymbol*>(item)->getID());
+                out.write("] ", 2);
+                }
+            else if(typeid(*item) == RuleHeadType)
+                {
+                out.put('[');
+                out.writeUnsigned(static_cast<const RuleHead*>(item)->getID());
+                out.put('(');
+                out.writeUnsigned(getRuleCount(static_cast<const RuleHead*>(item)));
+                out.write(")]: < ", 6);
+                }
+            else if(typeid(*item) == RuleTailType)
+                {
+                out.put('>');
+                }
+
+            if(!--number) return false;
+            else return true;
+            });
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::writeDigramIndex(OutputBuffer & out) const
+        {
+        for(Symbol * location : digram_index)
+            {
+            writeList(out, location, 2);
+            out.write(", ", 2);
+            }
+        out.put('\n');
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::exportText(OutputBuffer & out) const
+        {
+        for(const auto & rule_pair : rule_index)
+            {
+            out.writeUnsigned(rule_pair.first);
+            out.write(": ", 2);
+            writeList(out, rule_pair.second, 0);
+            out.put('\n');
+            }
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::exportJson(OutputBuffer & out) const
+        {
+        out.write("{\"length\":");
+        out.writeUnsigned(length);
+        out.write(",\"fingerprint\":\"");
+        out.writeHex(fingerprint().getValue());
+        out.write("\",\"rules\":[");
+
+        bool first_rule = true;
+        for(const auto & rule_pair : rule_index)
+            {
+            if(!first_rule) out.put(',');
+            first_rule = false;
+
+            out.write("\n{\"id\":");
+            out.writeUnsigned(rule_pair.first);
+            out.write(",\"uses\":");
+            out.writeUnsigned(getRuleCount(static_cast<const RuleHead*>(rule_pair.second)));
+            out.write(",\"symbols\":[");
+            for(const Symbol * item = rule_pair.second->next(); typeid(*item) != RuleTailType; item = item->next())
+                {
+                if(item != rule_pair.second->next()) out.put(',');
+                if(typeid(*item) == RuleSymbolType)
+                    {
+                    out.write("{\"rule\":");
+                    out.writeUnsigned(static_cast<const RuleSymbol*>(item)->getID());
+                    out.put('}');
+                    }
+                else export_format::writeJson(out, static_cast<const Value*>(item)->getValue());
+                }
+            out.write("]}");
+            }
+        out.write("\n]}\n");
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::exportDot(OutputBuffer & out) const
+        {
+        out.write("digraph grammar {\nnode [shape=box];\n");
+
+        std::vector<uint> uses;
+        for(const auto & rule_pair : rule_index)
+            {
+            out.put('R');
+            out.writeUnsigned(rule_pair.first);
+            out.write(" [label=\"");
+            out.writeUnsigned(rule_pair.first);
+            out.write(":");
+
+            uses.clear();
+            for(const Symbol * item = rule_pair.second->next(); typeid(*item) != RuleTailType; item = item->next())
+                {
+                out.put(' ');
+                if(typeid(*item) == RuleSymbolType)
+                    {
+                    uint id = static_cast<const RuleSymbol*>(item)->getID();
+                    out.put('[');
+                    out.writeUnsigned(id);
+                    out.put(']');
+                    uses.push_back(id);
+                    }
+                else export_format::writeLabel(out, static_cast<const Value*>(item)->getValue());
+                }
+            out.write("\"];\n");
+
+            //one edge per rule used, however many times:
+            std::sort(uses.begin(), uses.end());
+            uses.erase(std::unique(uses.begin(), uses.end()), uses.end());
+            for(uint id : uses)
+                {
+                out.put('R');
+                out.writeUnsigned(rule_pair.first);
+                out.write(" -> R");
+                out.writeUnsigned(id);
+                out.write(";\n");
+                }
+            }
+        out.write("}\n");
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::printList(const Symbol * list, unsigned int number) const
+        {
+        OutputBuffer out(std::cout);
+        writeList(out, list, number);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::printSequence() const
+        {
+        OutputBuffer out(std::cout);
+        writeList(out, rule_index.at(0), 0);
+        out.put('\n');
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::printRules() const
+        {
+        OutputBuffer out(std::cout);
+        exportText(out);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::printAll() const
+        {
+        OutputBuffer out(std::cout);
+        exportText(out);
+        writeDigramIndex(out);
+        out.put('\n');
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::printDigramIndex() const
+        {
+        OutputBuffer out(std::cout);
+        writeDigramIndex(out);
+        }
+
+    }//end jw namespace
+
+#endif // EXPORTER_HPP
@@ -0,0 +1,459 @@
+#ifndef FROZENGRAMMAR_HPP
+#define FROZENGRAMMAR_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// FrozenGrammar<Type> is an immutable copy of a Sequitur grammar, made using
+// Sequitur::freeze(), laid out for reading rather than building:
+// - every rule body is packed into one array of symbol codes, with rule n's
+//   body running from offsets[n] to offsets[n+1].
+// - a code's low bit says whether it's a rule (code >> 1 is the rule number)
+//   or a value (code >> 1 indexes the values array). So codes number at most
+//   2^31 rules and 2^31 value symbols, and offsets 2^32 symbols in all; a
+//   grammar bigger than that can't be frozen.
+// - rules are numbered in order of first use in the sequence (rule 0 is the
+//   sequence itself), so expanding walks the arrays mostly front to back.
+// - the expanded length of each rule is stored alongside.
+//
+// The grammar is a DAG, so statistics about the sequence can be worked out once
+// per rule and weighted by how often each rule occurs, rather than by expanding.
+
+#include <vector>
+#include <iterator>
+#include <cstdint>
+#include <cstddef>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+namespace jw
+    {
+
+    template<typename Type>
+    class FrozenGrammar
+        {
+        public:
+        using code_type = std::uint32_t;
+        using value_type = Type;
+        using const_value_type = const Type;
+
+        //a code is either a rule or a value:
+        static bool isRule(code_type code) { return code & 1; }
+        static code_type codeIndex(code_type code) { return code >> 1; }
+
+        //forward iterator over the expanded sequence:
+        class const_iterator
+            {
+            public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Type*;
+            using reference = const Type&;
+
+            const_iterator(const FrozenGrammar<Type> * in_parent, bool at_end);
+
+            const_value_type & operator* () const { return parent->value(*(position_stack.back().first)); }
+            const_value_type * operator-> () const { return &(parent->value(*(position_stack.back().first))); }
+
+            bool operator==(const const_iterator & other) const;
+            bool operator!=(const const_iterator & other) const { return !(*this == other); }
+
+            const_iterator & operator++();
+            const_iterator operator++(int);
+
+            private:
+            //descend into rules until we're looking at a value (or run out):
+            void resolve();
+
+            //current position and end of each rule body we're inside:
+            std::vector<std::pair<const code_type*, const code_type*>> position_stack;
+            const FrozenGrammar<Type> * parent;
+            };
+
+        //an empty grammar:
+        FrozenGrammar(): offsets(1, 0) {}
+
+        //freeze the grammar held by a Sequitur (see Sequitur::freeze()):
+        template<typename Grammar>
+        explicit FrozenGrammar(const Grammar & grammar);
+
+        const_iterator begin() const { return const_iterator(this, false); }
+        const_iterator end() const { return const_iterator(this, true); }
+
+        //write the whole sequence out, which is quicker than iterating:
+        template<typename OutputIt>
+        OutputIt expand(OutputIt out) const { return expand(0, size(), out); }
+
+        //write count values out, starting from position from in the sequence.
+        //rule lengths let us skip straight there rather than expanding up to it:
+        template<typename OutputIt>
+        OutputIt expand(std::size_t from, std::size_t count, OutputIt out) const;
+
+        //write the whole sequence to out (which must have room for size() values),
+        //splitting it into ranges that are expanded on separate threads. 0 threads
+        //means one per core:
+        void expandParallel(Type * out, unsigned threads = 0) const;
+
+        //number of rules, including rule 0:
+        unsigned ruleCount() const { return offsets.size()-1; }
+
+        //symbol codes making up a rule:
+        const code_type * ruleBegin(unsigned rule) const { return codes.data() + offsets[rule]; }
+        const code_type * ruleEnd(unsigned rule) const { return codes.data() + offsets[rule+1]; }
+
+        //value a (non rule) code refers to:
+        const Type & value(code_type code) const { return values[codeIndex(code)]; }
+
+        //number of values a rule expands to:
+        std::size_t ruleLength(unsigned rule) const { return lengths[rule]; }
+
+        //number of values in the sequence:
+        std::size_t size() const { return lengths.empty()? 0 : lengths[0]; }
+
+        //### statistics, computed without expanding ###
+
+        //number of times each rule occurs in the expanded sequence (rule 0 once):
+        std::vector<std::size_t> ruleMultiplicities() const;
+
+        //number of times each value occurs in the sequence:
+        std::unordered_map<Type, std::size_t> histogram() const;
+
+        //number of times a single value occurs in the sequence:
+        std::size_t count(const Type & value) const;
+
+        //### pattern search, without expanding (see sequitur/patternsearch.hpp) ###
+
+        //returned by find() when there is no match:
+        static const std::size_t npos = static_cast<std::size_t>(-1);
+
+        //position of the first occurrence of pattern, or npos:
+        std::size_t find(const std::vector<Type> & pattern) const;
+
+        //positions of every (possibly overlapping) occurrence of pattern:
+        std::vector<std::size_t> findAll(const std::vector<Type> & pattern) const;
+
+        //number of (possibly overlapping) occurrences of pattern:
+        std::size_t countPattern(const std::vector<Type> & pattern) const;
+
+        private:
+        std::vector<code_type> codes;
+        std::vector<code_type> offsets;
+        std::vector<Type> values;
+        std::vector<std::size_t> lengths;
+        };
+
+    template<typename Type>
+    template<typename Grammar>
+    FrozenGrammar<Type>::FrozenGrammar(const Grammar & grammar)
+        {
+        const code_type unnumbered = std::numeric_limits<code_type>::max();
+
+        //a rule we are part way through walking:
+        struct Position
+            {
+            const RuleHead * rule;
+            const Symbol * current;
+            };
+
+        //walk the sequence depth first, numbering rules the first time we enter them:
+        std::vector<const RuleHead*> order;
+        std::vector<code_type> numbering;
+        std::vector<Position> position_stack;
+
+        auto enter = [&](const RuleHead * rule)
+            {
+            if(rule->getID() >= numbering.size()) numbering.resize(rule->getID()+1, unnumbered);
+            numbering[rule->getID()] = order.size();
+            order.push_back(rule);
+            position_stack.push_back(Position{rule, rule->next()});
+            };
+
+        //all of a rule's children are finished with by the time we leave it,
+        //so its length can be totalled up then:
+        lengths.assign(grammar.getRules().size(), 0);
+
+        enter(static_cast<const RuleHead*>(grammar.getRules().at(0)));
+        while(!position_stack.empty())
+            {
+            Position & top = position_stack.back();
+            const std::type_info & type = typeid(*top.current);
+
+            if(type == grammar.RuleTailType)
+                {
+                std::size_t length = lengths[numbering[top.rule->getID()]];
+                position_stack.pop_back();
+                if(!position_stack.empty())
+                    lengths[numbering[position_stack.back().rule->getID()]] += length;
+                continue;
+                }
+
+            const Symbol * current = top.current;
+            top.current = current->next();
+            std::size_t & length = lengths[numbering[top.rule->getID()]];
+
+            if(type == grammar.RuleSymbolType)
+                {
+                const RuleHead * rule = static_cast<const RuleSymbol*>(current)->getRule();
+                if(rule->getID() < numbering.size() && numbering[rule->getID()] != unnumbered)
+                    length += lengths[numbering[rule->getID()]];
+                else enter(rule);
+                }
+            else ++length;
+            }
+
+        //rules nothing uses (dictionary rules, say) aren't included:
+        lengths.resize(order.size());
+
+        //now lay the rule bodies out one after another, as long as the numbers
+        //fit in a code (past the tag bit) and the offsets in a code_type:
+        const std::size_t most_numbered = std::numeric_limits<code_type>::max() >> 1;
+        const std::size_t most_codes = std::numeric_limits<code_type>::max();
+        if(order.size() - 1 > most_numbered) throw std::length_error("FrozenGrammar: too many rules.");
+        offsets.reserve(order.size()+1);
+        for(const RuleHead * rule : order)
+            {
+            offsets.push_back(codes.size());
+            rule->next()->forUntil([&](const Symbol * item)
+                {
+                const std::type_info & type = typeid(*item);
+                if(type == grammar.RuleTailType) return false;
+
+                if(type == grammar.RuleSymbolType)
+                    {
+                    code_type number = numbering[static_cast<const RuleSymbol*>(item)->getID()];
+                    codes.push_back((number << 1) | 1);
+                    }
+                else
+                    {
+                    if(values.size() > most_numbered) throw std::length_error("FrozenGrammar: too many values.");
+                    codes.push_back(values.size() << 1);
+                    values.push_back(static_cast<const typename Grammar::Value*>(item)->getValue());
+                    }
+                return true;
+                });
+            if(codes.size() > most_codes) throw std::length_error("FrozenGrammar: too many symbols.");
+            }
+        offsets.push_back(codes.size());
+        }
+
+    template<typename Type>
+    template<typename OutputIt>
+    OutputIt FrozenGrammar<Type>::expand(std::size_t from, std::size_t count, OutputIt out) const
+        {
+        if(from >= size()) return out;
+        count = std::min(count, size() - from);
+
+        //head down to the value at position from. Each level of the stack holds
+        //the next code to read in that rule, and where the rule ends:
+        std::vector<std::pair<const code_type*, const code_type*>> position_stack;
+        code_type rule = 0;
+        while(true)
+            {
+            const code_type * position = ruleBegin(rule);
+            std::size_t length;
+            while(from >= (length = isRule(*position)? lengths[codeIndex(*position)] : 1))
+                {
+                from -= length;
+                ++position;
+                }
+
+            if(!isRule(*position))
+                {
+                position_stack.push_back(std::make_pair(position, ruleEnd(rule)));
+                break;
+                }
+            position_stack.push_back(std::make_pair(position+1, ruleEnd(rule)));
+            rule = codeIndex(*position);
+            }
+
+        //now expand from there:
+        while(count)
+            {
+            auto & top = position_stack.back();
+            if(top.first == top.second)
+                {
+                position_stack.pop_back();
+                continue;
+                }
+
+            code_type code = *(top.first++);
+            if(isRule(code))
+                {
+                code_type rule = codeIndex(code);
+                position_stack.push_back(std::make_pair(ruleBegin(rule), ruleEnd(rule)));
+                }
+            else
+                {
+                *out++ = values[codeIndex(code)];
+                --count;
+                }
+            }
+        return out;
+        }
+
+    template<typename Type>
+    void FrozenGrammar<Type>::expandParallel(Type * out, unsigned threads) const
+        {
+        if(!threads) threads = std::thread::hardware_concurrency();
+        if(!threads) threads = 1;
+
+        //each thread writes to its own slice of out, so no locking is needed:
+        std::size_t total = size();
+        std::size_t chunk = (total + threads - 1) / threads;
+
+        std::vector<std::thread> workers;
+        for(unsigned i = 1; i < threads && i*chunk < total; ++i)
+            {
+            std::size_t from = i*chunk;
+            workers.emplace_back([this, out, from, chunk]()
+                {
+                expand(from, chunk, out + from);
+                });
+            }
+
+        //this thread takes the first slice:
+        expand(0, chunk, out);
+        for(auto & worker : workers) worker.join();
+        }
+
+    template<typename Type>
+    const std::size_t FrozenGrammar<Type>::npos;
+
+    template<typename Type>
+    std::vector<std::size_t> FrozenGrammar<Type>::ruleMultiplicities() const
+        {
+        std::vector<std::size_t> multiplicities(ruleCount(), 0);
+        if(!ruleCount()) return multiplicities;
+
+        //count references to each rule:
+        std::vector<code_type> references(ruleCount(), 0);
+        for(code_type code : codes)
+            {
+            if(isRule(code)) ++references[codeIndex(code)];
+            }
+
+        //then pass counts down from parents to children, only visiting a rule
+        //once every rule using it has been visited (so its count is complete):
+        std::vector<code_type> ready(1, 0);
+        multiplicities[0] = 1;
+        while(!ready.empty())
+            {
+            code_type rule = ready.back();
+            ready.pop_back();
+
+            for(const code_type * position = ruleBegin(rule); position != ruleEnd(rule); ++position)
+                {
+                if(!isRule(*position)) continue;
+                code_type child = codeIndex(*position);
+                multiplicities[child] += multiplicities[rule];
+                if(!--references[child]) ready.push_back(child);
+                }
+            }
+        return multiplicities;
+        }
+
+    template<typename Type>
+    std::unordered_map<Type, std::size_t> FrozenGrammar<Type>::histogram() const
+        {
+        std::unordered_map<Type, std::size_t> output;
+        std::vector<std::size_t> multiplicities = ruleMultiplicities();
+
+        for(unsigned rule = 0; rule < ruleCount(); ++rule)
+            {
+            for(const code_type * position = ruleBegin(rule); position != ruleEnd(rule); ++position)
+                {
+                if(!isRule(*position)) output[value(*position)] += multiplicities[rule];
+                }
+            }
+        return output;
+        }
+
+    template<typename Type>
+    std::size_t FrozenGrammar<Type>::count(const Type & target) const
+        {
+        std::size_t output = 0;
+        std::vector<std::size_t> multiplicities = ruleMultiplicities();
+
+        for(unsigned rule = 0; rule < ruleCount(); ++rule)
+            {
+            for(const code_type * position = ruleBegin(rule); position != ruleEnd(rule); ++position)
+                {
+                if(!isRule(*position) && value(*position) == target) output += multiplicities[rule];
+                }
+            }
+        return output;
+        }
+
+    //###############################
+    //### FrozenGrammar iterator  ###
+    //###############################
+
+    template<typename Type>
+    FrozenGrammar<Type>::const_iterator::const_iterator(const FrozenGrammar<Type> * in_parent, bool at_end):
+        parent(in_parent)
+        {
+        //the end iterator has nothing left on the stack:
+        if(at_end || !parent->size()) return;
+        position_stack.push_back(std::make_pair(parent->ruleBegin(0), parent->ruleEnd(0)));
+        resolve();
+        }
+
+    template<typename Type>
+    void FrozenGrammar<Type>::const_iterator::resolve()
+        {
+        while(!position_stack.empty())
+            {
+            auto & top = position_stack.back();
+            if(top.first == top.second)
+                {
+                //go up one level, and on past the rule we've finished:
+                position_stack.pop_back();
+                if(!position_stack.empty()) ++position_stack.back().first;
+                }
+            else if(isRule(*top.first))
+                {
+                //go down one level:
+                code_type rule = codeIndex(*top.first);
+                position_stack.push_back(std::make_pair(parent->ruleBegin(rule), parent->ruleEnd(rule)));
+                }
+            else return;
+            }
+        }
+
+    template<typename Type>
+    bool FrozenGrammar<Type>::const_iterator::operator==(const const_iterator & other) const
+        {
+        //the same place in two uses of a rule differs only further down the stack:
+        return position_stack == other.position_stack;
+        }
+
+    template<typename Type>
+    typename FrozenGrammar<Type>::const_iterator & FrozenGrammar<Type>::const_iterator::operator++()
+        {
+        ++position_stack.back().first;
+        resolve();
+        return *this;
+        }
+
+    template<typename Type>
+    typename FrozenGrammar<Type>::const_iterator FrozenGrammar<Type>::const_iterator::operator++(int)
+        {
+        const_iterator tmp(*this);
+        ++(*this);
+        return tmp;
+        }
+
+    //Sequitur::freeze() lives here, now FrozenGrammar is complete:
+    template<typename Type, typename Observer>
+    FrozenGrammar<Type> Sequitur<Type, Observer>::freeze() const
+        {
+        return FrozenGrammar<Type>(*this);
+        }
+
+    }//end jw namespace
+
+#endif // FROZENGRAMMAR_HPP
@@ -0,0 +1,116 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+// Histogram of latencies (or any other unsigned 64 bit amounts), with buckets
+// laid out as HdrHistogram does: values below 32 each get their own bucket,
+// and every power of two above that is split into 32 buckets. So whatever
+// the value, it is recorded to within about 3%, in a fixed 15KB of counts,
+// and recording is a couple of shifts and an increment.
+//
+// percentile() hands back the highest value in the bucket the percentile
+// falls in (never more than the largest value recorded).
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace jw
+    {
+
+    class LatencyHistogram
+        {
+        public:
+        LatencyHistogram(): counts(bucket_count, 0) {}
+
+        void record(std::uint64_t value)
+            {
+            ++counts[bucketOf(value)];
+            ++total;
+            sum += value;
+            if(value > largest) largest = value;
+            }
+
+        //add everything recorded in other to this:
+        void merge(const LatencyHistogram & other)
+            {
+            for(std::size_t i = 0; i < bucket_count; ++i) counts[i] += other.counts[i];
+            total += other.total;
+            sum += other.sum;
+            if(other.largest > largest) largest = other.largest;
+            }
+
+        //the value percent% of those recorded are at or below (0 if none are):
+        std::uint64_t percentile(double percent) const
+            {
+            if(!total) return 0;
+            std::uint64_t wanted = std::uint64_t(percent / 100.0 * total + 0.5);
+            if(wanted < 1) wanted = 1;
+            if(wanted > total) wanted = total;
+
+            std::uint64_t seen = 0;
+            for(std::size_t i = 0; i < bucket_count; ++i)
+                {
+                seen += counts[i];
+                if(seen >= wanted)
+                    {
+                    std::uint64_t highest = highestIn(i);
+                    return highest < largest? highest : largest;
+                    }
+                }
+            return largest;
+            }
+
+        std::uint64_t count() const { return total; }
+        std::uint64_t max() const { return largest; }
+        double mean() const { return total? double(sum) / total : 0; }
+
+        //forget everything recorded:
+        void clear()
+            {
+            counts.assign(bucket_count, 0);
+            total = sum = largest = 0;
+            }
+
+        private:
+        //each power of two is split into 2^sub_bits buckets:
+        static const unsigned sub_bits = 5;
+        static const std::size_t sub_buckets = std::size_t(1) << sub_bits;
+        static const std::size_t bucket_count = (64 - sub_bits + 1) * sub_buckets;
+
+        static unsigned highestBit(std::uint64_t value)
+            {
+        #if defined(__GNUC__) || defined(__clang__)
+            return 63 - __builtin_clzll(value);
+        #else
+            unsigned bit = 0;
+            while(value >>= 1) ++bit;
+            return bit;
+        #endif
+            }
+
+        //values below sub_buckets go in their own bucket; above that, the top
+        //sub_bits+1 bits of a value pick its bucket:
+        static std::size_t bucketOf(std::uint64_t value)
+            {
+            if(value < sub_buckets) return value;
+            unsigned shift = highestBit(value) - sub_bits;
+            return (shift + 1) * sub_buckets + ((value >> shift) - sub_buckets);
+            }
+
+        static std::uint64_t highestIn(std::size_t bucket)
+            {
+            if(bucket < sub_buckets) return bucket;
+            unsigned shift = bucket / sub_buckets - 1;
+            std::uint64_t lowest = std::uint64_t(sub_buckets + bucket % sub_buckets) << shift;
+            return lowest + ((std::uint64_t(1) << shift) - 1);
+            }
+
+        std::vector<std::uint64_t> counts;
+        std::uint64_t total = 0;
+        std::uint64_t sum = 0;
+        std::uint64_t largest = 0;
+        };
+
+    } //end jw namespace
+
+#endif // HISTOGRAM_HPP
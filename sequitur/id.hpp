@@ -1,7 +1,8 @@
 #ifndef JAMDAWG_ID_HPP_INCLUDED
 #define JAMDAWG_ID_HPP_INCLUDED
 
-#include <stack>
+#include <vector>
+#include <utility>
 #include <iostream>
 
 //generates a unique value when used:
@@ -9,17 +10,24 @@ class ID
     {
     private:
 
-    unsigned int val = 0;
-    std::stack<unsigned int> free_ids;
+    unsigned int val;
+    //explicit free list of IDs to hand out again (last in, first out), kept contiguous:
+    std::vector<unsigned int> free_ids;
 
     public:
 
+    //IDs below first_id are treated as taken:
+    explicit ID(unsigned int first_id = 0): val(first_id) {}
+    //pick up where another generator left off:
+    ID(unsigned int next_unused, std::vector<unsigned int> in_free_ids):
+        val(next_unused), free_ids(std::move(in_free_ids)) {}
+
     unsigned int get()
         {
         if(!free_ids.empty())
             {
-            unsigned int return_val = free_ids.top();
-            free_ids.pop();
+            unsigned int return_val = free_ids.back();
+            free_ids.pop_back();
             return return_val;
             }
 
@@ -27,8 +35,12 @@ class ID
         }
     void free(unsigned int id)
         {
-        free_ids.push(id);
+        free_ids.push_back(id);
         }
+
+    //state, for saving:
+    unsigned int nextUnused() const { return val; }
+    const std::vector<unsigned int> & freeIds() const { return free_ids; }
     };
 
 #endif // JAMDAWG_ID_HPP_INCLUDED
@@ -0,0 +1,82 @@
+#ifndef INTERNEDSEQUITUR_HPP
+#define INTERNEDSEQUITUR_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// InternedSequitur<Type> interns each value as it is pushed back and builds the
+// grammar over the resulting IDs, so values are hashed once and never copied
+// around while digrams are probed. Iterating resolves IDs back to values. This
+// is the one to use for things like std::string tokens; for small values like
+// char, plain Sequitur<Type> is faster.
+
+#include "interner.hpp"
+
+namespace jw
+    {
+
+    template<typename Type>
+    class InternedSequitur
+        {
+        public:
+        using Grammar = Sequitur<typename Interner<Type>::id_type>;
+        using value_type = Type;
+        using const_value_type = const Type;
+
+        //wraps a grammar iterator, looking up values as we go:
+        template<typename BaseIter>
+        class InternedIter
+            {
+            public:
+            InternedIter(BaseIter in_it, const Interner<Type> * in_table): it(in_it), table(in_table) {}
+
+            const_value_type & operator* () { return table->lookup(*it); }
+            const_value_type * operator-> () { return &(table->lookup(*it)); }
+
+            bool operator==(const InternedIter & other) const { return it == other.it; }
+            bool operator!=(const InternedIter & other) const { return it != other.it; }
+
+            InternedIter & operator++() { ++it; return *this; }
+            InternedIter operator++(int) { InternedIter tmp(*this); ++it; return tmp; }
+            InternedIter & operator--() { --it; return *this; }
+            InternedIter operator--(int) { InternedIter tmp(*this); --it; return tmp; }
+
+            private:
+            BaseIter it;
+            const Interner<Type> * table;
+            };
+
+        using const_iterator = InternedIter<typename Grammar::const_iterator>;
+        using const_reverse_iterator = InternedIter<typename Grammar::const_reverse_iterator>;
+
+        void push_back(const Type & value) { grammar.push_back(symbol_table.intern(value)); }
+
+        const_iterator begin() const { return const_iterator(grammar.begin(), &symbol_table); }
+        const_iterator end() const { return const_iterator(grammar.end(), &symbol_table); }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(grammar.rbegin(), &symbol_table); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(grammar.rend(), &symbol_table); }
+
+        //the grammar over IDs, and the table to turn IDs back into values:
+        const Grammar & getGrammar() const { return grammar; }
+        const Interner<Type> & getSymbolTable() const { return symbol_table; }
+
+        void setExpansionBatch(unsigned batch_size) { grammar.setExpansionBatch(batch_size); }
+        void finalize() { grammar.finalize(); }
+
+        //the symbol table is cleared too, as the IDs would no longer be used:
+        void reset()
+            {
+            grammar.reset();
+            symbol_table.clear();
+            }
+        void clear() { reset(); }
+
+        unsigned size() const { return grammar.size(); }
+
+        private:
+        Grammar grammar;
+        Interner<Type> symbol_table;
+        };
+
+    } //end jw namespace
+
+#endif // INTERNEDSEQUITUR_HPP
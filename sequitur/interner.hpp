@@ -0,0 +1,50 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+
+// Maps each distinct value to a dense integer ID, and back again. Each value
+// is stored once; IDs are handed out in order of first appearance.
+
+#include <unordered_map>
+#include <vector>
+
+namespace jw
+    {
+
+    template<typename Type>
+    class Interner
+        {
+        public:
+        using id_type = unsigned int;
+
+        //return the ID for value, adding it if we haven't seen it before:
+        id_type intern(const Type & value)
+            {
+            auto out_pair = ids.emplace(value, static_cast<id_type>(values.size()));
+            //map nodes don't move, so we can point into them:
+            if(out_pair.second) values.push_back(&(out_pair.first->first));
+            return out_pair.first->second;
+            }
+
+        //return the value an ID stands for:
+        const Type & lookup(id_type id) const
+            {
+            return *values[id];
+            }
+
+        //number of distinct values seen:
+        unsigned size() const { return values.size(); }
+
+        void clear()
+            {
+            ids.clear();
+            values.clear();
+            }
+
+        private:
+        std::unordered_map<Type, id_type> ids;
+        std::vector<const Type*> values;
+        };
+
+    } //end jw namespace
+
+#endif // INTERNER_HPP
@@ -0,0 +1,116 @@
+#ifndef LATENCY_HPP
+#define LATENCY_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// Throughput can hide that a few push_back() calls take far longer than the
+// rest: one may set off a long cascade of rule changes, or grow the digram
+// index. A LatencyTrace handed to traceLatency() gathers how long each of
+// these takes into a LatencyHistogram (see sequitur/histogram.hpp), so the
+// tail (percentile(99.9), say) can be read off. push_back() calls taking at
+// least slow_call_ns are also handed to on_slow_call as they return, which
+// can look at what happened with writeNeighbourhood():
+//
+//   LatencyTrace trace;
+//   trace.slow_call_ns = 100000;
+//   trace.on_slow_call = [&](std::uint64_t ns, std::uint64_t position)
+//       {
+//       OutputBuffer out(std::cerr);
+//       s.writeNeighbourhood(out);
+//       };
+//   s.traceLatency(&trace);
+//
+// Tracing costs two clock reads per push_back(); when off, just a check.
+// Only push_back() is timed, as pushRange() and pushRun() add many values per
+// call.
+
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+namespace jw
+    {
+
+    class LatencyTrace
+        {
+        public:
+        //nanoseconds taken by each push_back(), and by each growth of the digram index:
+        LatencyHistogram pushes;
+        LatencyHistogram index_growth;
+
+        //push_back() calls taking at least this many nanoseconds (0 for none) are
+        //passed to on_slow_call, with the position of the value they added:
+        std::uint64_t slow_call_ns = 0;
+        std::function<void(std::uint64_t nanoseconds, std::uint64_t position)> on_slow_call;
+
+        void clear()
+            {
+            pushes.clear();
+            index_growth.clear();
+            }
+        };
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::traceLatency(LatencyTrace * trace)
+        {
+        latency = trace;
+        digram_index.recordGrowth(trace? &trace->index_growth : nullptr);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::tracedPushBack(Type value)
+        {
+        auto start = std::chrono::steady_clock::now();
+        pushSymbol(new Value(value));
+        std::uint64_t taken = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+        latency->pushes.record(taken);
+        if(latency->slow_call_ns && taken >= latency->slow_call_ns && latency->on_slow_call)
+            latency->on_slow_call(taken, length - 1);
+        }
+
+    template<typename Type, typename Observer>
+    void Sequitur<Type, Observer>::writeNeighbourhood(OutputBuffer & out, unsigned symbols) const
+        {
+        //step back from the end to the start of the neighbourhood:
+        const Symbol * start_head = rule_index.at(0);
+        const Symbol * first = sequence_end;
+        for(unsigned i = 0; i < symbols && first->prev() != start_head; ++i) first = first->prev();
+
+        out.write("0: ... ", 7);
+        if(first != sequence_end) writeList(out, first, 0);
+        else out.put('>');
+        out.put('\n');
+
+        //then the rules used in it, and the rules those use (a cascade of rule
+        //changes works its way down from the end of the sequence):
+        std::vector<const RuleHead*> rules;
+        for(const Symbol * item = first; item != sequence_end; item = item->next())
+            {
+            if(typeid(*item) == RuleSymbolType) rules.push_back(static_cast<const RuleSymbol*>(item)->getRule());
+            }
+        const std::size_t used_directly = rules.size();
+        for(std::size_t i = 0; i < used_directly; ++i)
+            {
+            for(const Symbol * item = rules[i]->next(); item != rules[i]->getTail(); item = item->next())
+                {
+                if(typeid(*item) == RuleSymbolType) rules.push_back(static_cast<const RuleSymbol*>(item)->getRule());
+                }
+            }
+        std::sort(rules.begin(), rules.end(), [](const RuleHead * a, const RuleHead * b) { return a->getID() < b->getID(); });
+        rules.erase(std::unique(rules.begin(), rules.end()), rules.end());
+
+        for(const RuleHead * rule : rules)
+            {
+            out.writeUnsigned(rule->getID());
+            out.write(": ", 2);
+            writeList(out, rule, 0);
+            out.put('\n');
+            }
+        }
+
+    } //end jw namespace
+
+#endif // LATENCY_HPP
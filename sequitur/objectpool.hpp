@@ -209,14 +209,16 @@ namespace jw{
         ObjectPool() {}
         ObjectPool(const ObjectPool &) {}
 
-        static PoolClass<Child> pool;
+        //one pool per thread, so grammars on different threads don't contend
+        //(memory freed on another thread just joins that thread's pool):
+        static thread_local PoolClass<Child> pool;
 
         //Child class can make instances:
         friend Child;
         };
 
     template<typename Child, template<typename> class PoolClass>
-    PoolClass<Child> ObjectPool<Child,PoolClass>::pool(1000);
+    thread_local PoolClass<Child> ObjectPool<Child,PoolClass>::pool(1000);
 
     //inherit from UseObjectPool(classname} to use the object pool:
     // - disallows any inheritance from this class (would cause issues)
@@ -0,0 +1,60 @@
+#ifndef OBSERVER_HPP
+#define OBSERVER_HPP
+
+// Sequitur<Type, Observer> calls its Observer as rules come and go, so that
+// something following the grammar (an online encoder, live metrics) doesn't
+// have to compare getRules() snapshots. The Observer is a member of the
+// grammar (getObserver()), and must have these four functions:
+//
+//   ruleCreated(const RuleHead * rule)
+//       a new rule has been made (from a repeated digram, or by pushRun());
+//       ruleUsed() follows for each use put in the grammar.
+//   ruleUsed(const RuleHead * rule, const Symbol * location)
+//       a digram has been swapped for a use of rule, now at location.
+//   ruleInlined(const RuleHead * rule, const Symbol * first, const Symbol * last)
+//       a use of rule has been swapped for its body, which now runs from first
+//       to last where the use was.
+//   ruleRemoved(const RuleHead * rule)
+//       rule is no longer used and is about to be deleted; its ID (and memory)
+//       will be reused.
+//
+// Events come while the grammar is part way through an update, so they should
+// only look, not change anything. Rules made by append(), resume() or RePair
+// aren't reported, nor are IDs changed by compactRuleIds(), and reset() just
+// starts afresh.
+//
+// NoObserver, the default, does nothing, and as its functions are empty and
+// inline, they cost nothing either.
+
+#include <cstdint>
+
+#include "symbols.hpp"
+
+namespace jw
+    {
+
+    struct NoObserver
+        {
+        void ruleCreated(const RuleHead *) {}
+        void ruleUsed(const RuleHead *, const Symbol *) {}
+        void ruleInlined(const RuleHead *, const Symbol *, const Symbol *) {}
+        void ruleRemoved(const RuleHead *) {}
+        };
+
+    //counts of each event, for live metrics:
+    struct RuleEventCounts
+        {
+        std::uint64_t created = 0;
+        std::uint64_t used = 0;
+        std::uint64_t inlined = 0;
+        std::uint64_t removed = 0;
+
+        void ruleCreated(const RuleHead *) { ++created; }
+        void ruleUsed(const RuleHead *, const Symbol *) { ++used; }
+        void ruleInlined(const RuleHead *, const Symbol *, const Symbol *) { ++inlined; }
+        void ruleRemoved(const RuleHead *) { ++removed; }
+        };
+
+    } //end jw namespace
+
+#endif // OBSERVER_HPP
@@ -0,0 +1,440 @@
+#ifndef ONLINEENCODER_HPP
+#define ONLINEENCODER_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// OnlineEncoder sends a grammar's sequence as it is built, rather than once
+// the whole input is in, using the "implicit" encoding from the Sequitur
+// papers: the first time a rule turns up it is sent as what it expands to,
+// the second time as a pointer back to that, which is when the decoder gives
+// it a number, and from then on as its number. It is the grammar's Observer,
+// so it hears when a rule is deleted (and its RuleHead may be reused):
+//
+//   Sequitur<char, OnlineEncoder<char>> s;
+//   OnlineEncoder<char> & encoder = s.getObserver();
+//   encoder.setLag(4096);
+//   //...for each chunk read:
+//   s.pushRange(chunk.begin(), chunk.end());
+//   encoder.send(s, out);
+//   out.flush();
+//   //...and at the end:
+//   encoder.finish(s, out);
+//
+// The end of the sequence is still being reworked into rules, so send() only
+// writes out symbols that end at least lag values back from it. A symbol
+// running past that point is held back until it is done, unless that would
+// hold back more than lag further values, in which case the parts of it that
+// are done are sent. Nothing sent ever needs taking back: the decoder only
+// learns what a rule expands to, which never changes, and rules are forgotten
+// again when they are deleted. send() walks back over what is still unsent,
+// so it waits until at least lag/16 values are ready, and can be called as
+// often as is handy.
+//
+// The stream is a series of tokens, each starting with an unsigned LEB128
+// varint whose low two bits say what it is, and whose other bits n are:
+// - Literals: n values follow, each as its bytes (so Type must be trivially
+//   copyable, and both ends need the same byte order).
+// - Pointer: n values are copied from a varint distance back in the output,
+//   and become the next rule number (the last freed first, as ID hands them
+//   out).
+// - Rule: rule number n is copied.
+// - Control: 0 ends the stream, and n+1 frees rule number n.
+//
+// OnlineDecoder takes the stream back, in pieces split anywhere. It keeps
+// everything it has decoded, as pointers may reach back to the start.
+
+#include <unordered_map>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+namespace jw
+    {
+
+    namespace online_format
+        {
+        //low two bits of each token:
+        enum Token: unsigned
+            {
+            LiteralToken = 0,
+            PointerToken = 1,
+            RuleToken = 2,
+            ControlToken = 3
+            };
+
+        inline void writeVarint(OutputBuffer & out, std::uint64_t number)
+            {
+            while(number >= 0x80)
+                {
+                out.put(char((number & 0x7F) | 0x80));
+                number >>= 7;
+                }
+            out.put(char(number));
+            }
+
+        //read a varint from [bytes + at, bytes + size), moving at past it; false if
+        //it isn't all there yet:
+        inline bool readVarint(const char * bytes, std::size_t size, std::size_t & at, std::uint64_t & number)
+            {
+            number = 0;
+            for(unsigned shift = 0; at < size; shift += 7)
+                {
+                if(shift > 63) throw std::runtime_error("bad varint in online encoding.");
+                unsigned char byte = bytes[at++];
+                number |= std::uint64_t(byte & 0x7F) << shift;
+                if(!(byte & 0x80)) return true;
+                }
+            return false;
+            }
+        }
+
+    template<typename Type>
+    class OnlineEncoder
+        {
+        public:
+        using Grammar = Sequitur<Type, OnlineEncoder<Type>>;
+
+        //values are held back until they are lag values from the end:
+        explicit OnlineEncoder(std::uint64_t in_lag = 4096): lag(in_lag) {}
+        void setLag(std::uint64_t in_lag) { lag = in_lag; }
+
+        //write out what has settled in grammar, which must be the grammar this
+        //is the observer of:
+        void send(const Grammar & grammar, OutputBuffer & out);
+
+        //write out everything left, and the end of the stream:
+        void finish(const Grammar & grammar, OutputBuffer & out);
+
+        //number of values sent so far:
+        std::uint64_t sentCount() const { return sent; }
+
+        //start a new stream, as for a grammar that has been reset():
+        void reset();
+
+        //observer events; only deletions matter to us:
+        void ruleCreated(const RuleHead *) {}
+        void ruleUsed(const RuleHead *, const Symbol *) {}
+        void ruleInlined(const RuleHead *, const Symbol *, const Symbol *) {}
+        void ruleRemoved(const RuleHead * rule);
+
+        private:
+        //what the decoder knows of a rule: where it was first sent, and its number
+        //once it has one:
+        struct RuleState
+            {
+            std::uint64_t first;
+            bool numbered;
+            unsigned int number;
+            };
+
+        //a place in a rule body part way through sending:
+        struct Position
+            {
+            const RuleHead * rule;
+            const Symbol * item;
+            std::uint64_t start;
+            };
+
+        static std::uint64_t lengthOf(const Symbol * item)
+            {
+            if(typeid(*item) == typeid(RuleSymbol)) return static_cast<const RuleSymbol*>(item)->getRule()->getContentHash().getLength();
+            return 1;
+            }
+
+        //send the symbols of rule 0 ending by limit:
+        void sendUpTo(const Grammar & grammar, std::uint64_t limit, OutputBuffer & out);
+
+        //send a symbol starting at sent:
+        void sendWhole(const Symbol * item, OutputBuffer & out);
+
+        //send a rule by number or pointer if the decoder has seen it; false if not:
+        bool sendKnown(const RuleHead * rule, OutputBuffer & out);
+
+        void sendLiterals(OutputBuffer & out);
+
+        std::uint64_t lag;
+        std::uint64_t sent = 0;
+        std::unordered_map<const RuleHead*, RuleState> rules;
+        ID numbers;
+        //numbers of deleted rules, to free at the start of the next send():
+        std::vector<unsigned int> forgotten;
+        //values waiting to go out as one literals token:
+        std::vector<Type> literals;
+        std::vector<Position> position_stack;
+        };
+
+    template<typename Type>
+    class OnlineDecoder
+        {
+        public:
+        //decode size more bytes of the stream, returning how many values that added:
+        std::size_t receive(const char * bytes, std::size_t size);
+
+        //everything decoded so far:
+        const std::vector<Type> & values() const { return decoded; }
+
+        //whether the end of the stream has been seen:
+        bool finished() const { return ended; }
+
+        private:
+        void copy(std::uint64_t start, std::uint64_t length);
+
+        std::vector<Type> decoded;
+        //where each numbered rule was copied from, and its length:
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> rules;
+        ID numbers;
+        //bytes of a token that hasn't all arrived yet:
+        std::vector<char> pending;
+        std::uint64_t literals_left = 0;
+        bool ended = false;
+        };
+
+    template<typename Type>
+    void OnlineEncoder<Type>::send(const Grammar & grammar, OutputBuffer & out)
+        {
+        //the walk back to what's unsent costs about lag, so wait for a few values:
+        std::uint64_t limit = grammar.size() > lag? grammar.size() - lag : 0;
+        if(limit > sent && limit - sent > lag / 16) sendUpTo(grammar, limit, out);
+        }
+
+    template<typename Type>
+    void OnlineEncoder<Type>::finish(const Grammar & grammar, OutputBuffer & out)
+        {
+        sendUpTo(grammar, grammar.size(), out);
+        online_format::writeVarint(out, online_format::ControlToken);
+        }
+
+    template<typename Type>
+    void OnlineEncoder<Type>::reset()
+        {
+        sent = 0;
+        rules.clear();
+        numbers = ID();
+        forgotten.clear();
+        literals.clear();
+        }
+
+    template<typename Type>
+    void OnlineEncoder<Type>::ruleRemoved(const RuleHead * rule)
+        {
+        auto found = rules.find(rule);
+        if(found == rules.end()) return;
+        if(found->second.numbered)
+            {
+            numbers.free(found->second.number);
+            forgotten.push_back(found->second.number);
+            }
+        rules.erase(found);
+        }
+
+    template<typename Type>
+    void OnlineEncoder<Type>::sendUpTo(const Grammar & grammar, std::uint64_t limit, OutputBuffer & out)
+        {
+        static_assert(std::is_trivially_copyable<Type>::value, "OnlineEncoder needs a trivially copyable Type.");
+        using namespace online_format;
+        if(&grammar.getObserver() != this) throw std::invalid_argument("OnlineEncoder can only send the grammar it observes.");
+
+        //the decoder must free numbers in the order we did:
+        for(unsigned int number : forgotten) writeVarint(out, (std::uint64_t(number) + 1) << 2 | ControlToken);
+        forgotten.clear();
+        if(sent >= limit) return;
+
+        //step back from the end to the symbol holding the first unsent value:
+        const RuleHead * start_rule = static_cast<const RuleHead*>(grammar.getRules().at(0));
+        const Symbol * first = start_rule->getTail();
+        std::uint64_t start = grammar.size();
+        while(start > sent)
+            {
+            first = first->prev();
+            start -= lengthOf(first);
+            }
+
+        //then send symbols in order. Where one is only partly sent, or runs past
+        //limit and would hold back too much, step into its rule and carry on
+        //with its parts:
+        position_stack.clear();
+        position_stack.push_back({start_rule, first, start});
+        while(!position_stack.empty())
+            {
+            Position & position = position_stack.back();
+            const Symbol * item = position.item;
+            if(item == position.rule->getTail())
+                {
+                position_stack.pop_back();
+                continue;
+                }
+            std::uint64_t item_start = position.start;
+            std::uint64_t item_end = item_start + lengthOf(item);
+            position.item = item->next();
+            position.start = item_end;
+
+            if(item_end <= sent) continue;
+            if(item_start >= sent && item_end <= limit)
+                {
+                sendWhole(item, out);
+                continue;
+                }
+            if(typeid(*item) != typeid(RuleSymbol) || (item_start >= sent && limit - item_start <= lag)) break;
+
+            const RuleHead * rule = static_cast<const RuleSymbol*>(item)->getRule();
+            position_stack.push_back({rule, rule->next(), item_start});
+            }
+
+        sendLiterals(out);
+        }
+
+    template<typename Type>
+    void OnlineEncoder<Type>::sendWhole(const Symbol * item, OutputBuffer & out)
+        {
+        if(typeid(*item) != typeid(RuleSymbol))
+            {
+            literals.push_back(static_cast<const ValueSymbol<Type>*>(item)->getValue());
+            ++sent;
+            return;
+            }
+        const RuleHead * rule = static_cast<const RuleSymbol*>(item)->getRule();
+        if(sendKnown(rule, out)) return;
+
+        //first time: send what it expands to, its rules in turn sent however the
+        //decoder knows them. Each rule is noted once it has all gone:
+        std::size_t base = position_stack.size();
+        position_stack.push_back({rule, rule->next(), sent});
+        while(position_stack.size() > base)
+            {
+            Position & position = position_stack.back();
+            const Symbol * child = position.item;
+            if(child == position.rule->getTail())
+                {
+                rules[position.rule] = RuleState{position.start, false, 0};
+                position_stack.pop_back();
+                continue;
+                }
+            position.item = child->next();
+
+            if(typeid(*child) != typeid(RuleSymbol))
+                {
+                literals.push_back(static_cast<const ValueSymbol<Type>*>(child)->getValue());
+                ++sent;
+                continue;
+                }
+            const RuleHead * child_rule = static_cast<const RuleSymbol*>(child)->getRule();
+            if(!sendKnown(child_rule, out)) position_stack.push_back({child_rule, child_rule->next(), sent});
+            }
+        }
+
+    template<typename Type>
+    bool OnlineEncoder<Type>::sendKnown(const RuleHead * rule, OutputBuffer & out)
+        {
+        using namespace online_format;
+        auto found = rules.find(rule);
+        if(found == rules.end()) return false;
+
+        RuleState & state = found->second;
+        std::uint64_t length = rule->getContentHash().getLength();
+        sendLiterals(out);
+        if(state.numbered) writeVarint(out, std::uint64_t(state.number) << 2 | RuleToken);
+        else
+            {
+            writeVarint(out, length << 2 | PointerToken);
+            writeVarint(out, sent - state.first);
+            state.numbered = true;
+            state.number = numbers.get();
+            }
+        sent += length;
+        return true;
+        }
+
+    template<typename Type>
+    void OnlineEncoder<Type>::sendLiterals(OutputBuffer & out)
+        {
+        if(literals.empty()) return;
+        online_format::writeVarint(out, std::uint64_t(literals.size()) << 2 | online_format::LiteralToken);
+        out.write(reinterpret_cast<const char*>(literals.data()), literals.size() * sizeof(Type));
+        literals.clear();
+        }
+
+    template<typename Type>
+    std::size_t OnlineDecoder<Type>::receive(const char * bytes, std::size_t size)
+        {
+        static_assert(std::is_trivially_copyable<Type>::value, "OnlineDecoder needs a trivially copyable Type.");
+        using namespace online_format;
+
+        pending.insert(pending.end(), bytes, bytes + size);
+        const char * data = pending.data();
+        std::size_t available = pending.size();
+        std::size_t at = 0;
+        std::size_t decoded_before = decoded.size();
+
+        while(at < available)
+            {
+            if(ended) throw std::runtime_error("data after the end of an online encoding.");
+            if(literals_left)
+                {
+                std::uint64_t whole = (available - at) / sizeof(Type);
+                if(!whole) break;
+                if(whole > literals_left) whole = literals_left;
+                std::size_t old_size = decoded.size();
+                decoded.resize(old_size + whole);
+                std::memcpy(static_cast<void*>(decoded.data() + old_size), data + at, whole * sizeof(Type));
+                at += whole * sizeof(Type);
+                literals_left -= whole;
+                continue;
+                }
+
+            //tokens are only taken once all their varints have arrived:
+            std::size_t token_start = at;
+            std::uint64_t token = 0;
+            std::uint64_t distance = 0;
+            if(!readVarint(data, available, at, token)) { at = token_start; break; }
+            std::uint64_t n = token >> 2;
+            switch(token & 3)
+                {
+                case LiteralToken:
+                    literals_left = n;
+                    break;
+                case PointerToken:
+                    if(!readVarint(data, available, at, distance)) { at = token_start; break; }
+                    if(!distance || distance > decoded.size() || n > distance) throw std::runtime_error("bad pointer in online encoding.");
+                    {
+                    unsigned int number = numbers.get();
+                    if(number >= rules.size()) rules.resize(number + 1);
+                    rules[number] = {decoded.size() - distance, n};
+                    copy(decoded.size() - distance, n);
+                    }
+                    break;
+                case RuleToken:
+                    if(n >= rules.size() || !rules[n].second) throw std::runtime_error("unknown rule in online encoding.");
+                    copy(rules[n].first, rules[n].second);
+                    break;
+                case ControlToken:
+                    if(!n) ended = true;
+                    else
+                        {
+                        if(n - 1 >= rules.size() || !rules[n - 1].second) throw std::runtime_error("unknown rule in online encoding.");
+                        rules[n - 1] = {0, 0};
+                        numbers.free(n - 1);
+                        }
+                    break;
+                }
+            if(at == token_start) break;
+            }
+
+        pending.erase(pending.begin(), pending.begin() + at);
+        return decoded.size() - decoded_before;
+        }
+
+    template<typename Type>
+    void OnlineDecoder<Type>::copy(std::uint64_t start, std::uint64_t length)
+        {
+        //copied from ourselves, so make room first:
+        decoded.reserve(decoded.size() + length);
+        for(std::uint64_t i = 0; i < length; ++i) decoded.push_back(decoded[start + i]);
+        }
+
+    } //end jw namespace
+
+#endif // ONLINEENCODER_HPP
@@ -0,0 +1,232 @@
+#ifndef PATTERNSEARCH_HPP
+#define PATTERNSEARCH_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// PatternSearch<Type> finds a pattern in a FrozenGrammar without expanding it.
+// The pattern is turned into a KMP automaton. For each rule and automaton
+// state we enter it in, we remember the state we leave it in and how many
+// matches happened inside. Repeated rules are then stepped over in one go,
+// and only rules containing matches are looked inside to find where they are.
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+namespace jw
+    {
+
+    template<typename Type>
+    class PatternSearch
+        {
+        public:
+        using code_type = typename FrozenGrammar<Type>::code_type;
+
+        PatternSearch(const FrozenGrammar<Type> & in_grammar, const std::vector<Type> & in_pattern);
+
+        //number of (possibly overlapping) occurrences of the pattern:
+        std::size_t count();
+
+        //position of the first occurrence, or FrozenGrammar<Type>::npos if none:
+        std::size_t find();
+
+        //positions of every occurrence, in order:
+        std::vector<std::size_t> findAll() { return locate(false); }
+
+        private:
+        //what happens to the automaton over a whole rule:
+        struct Summary
+            {
+            unsigned exit_state;
+            std::size_t matches;
+            };
+
+        //advance the automaton by one value:
+        unsigned step(unsigned state, const Type & value) const;
+
+        //summary of a rule entered in some state, working it out if needbe:
+        const Summary & summarise(code_type rule, unsigned state);
+
+        //walk the sequence noting match positions, stopping after one if first_only:
+        std::vector<std::size_t> locate(bool first_only);
+
+        const FrozenGrammar<Type> & grammar;
+        std::vector<Type> pattern;
+        //KMP failure function; failure[i] is the state to fall back to from state i:
+        std::vector<unsigned> failure;
+        std::unordered_map<std::uint64_t, Summary> summaries;
+        };
+
+    template<typename Type>
+    PatternSearch<Type>::PatternSearch(const FrozenGrammar<Type> & in_grammar, const std::vector<Type> & in_pattern):
+        grammar(in_grammar), pattern(in_pattern), failure(in_pattern.size()+1, 0)
+        {
+        //standard KMP prefix function:
+        for(unsigned i = 1, state = 0; i < pattern.size(); ++i)
+            {
+            while(state && !(pattern[i] == pattern[state])) state = failure[state];
+            if(pattern[i] == pattern[state]) ++state;
+            failure[i+1] = state;
+            }
+        }
+
+    template<typename Type>
+    unsigned PatternSearch<Type>::step(unsigned state, const Type & value) const
+        {
+        //after a full match, carry on from the longest proper border:
+        if(state == pattern.size()) state = failure[state];
+        while(state && !(pattern[state] == value)) state = failure[state];
+        return pattern[state] == value? state+1 : 0;
+        }
+
+    template<typename Type>
+    const typename PatternSearch<Type>::Summary & PatternSearch<Type>::summarise(code_type rule, unsigned state)
+        {
+        auto key = [](code_type r, unsigned s) { return (std::uint64_t(r) << 32) | s; };
+
+        auto found = summaries.find(key(rule, state));
+        if(found != summaries.end()) return found->second;
+
+        //work summaries out using an explicit stack rather than recursion, so
+        //deep grammars can't overflow it:
+        struct Frame
+            {
+            code_type rule;
+            unsigned entry_state;
+            const code_type * position;
+            unsigned state;
+            std::size_t matches;
+            };
+        std::vector<Frame> frame_stack;
+        frame_stack.push_back(Frame{rule, state, grammar.ruleBegin(rule), state, 0});
+
+        while(true)
+            {
+            Frame & top = frame_stack.back();
+            if(top.position == grammar.ruleEnd(top.rule))
+                {
+                Summary summary{top.state, top.matches};
+                summaries[key(top.rule, top.entry_state)] = summary;
+                frame_stack.pop_back();
+                if(frame_stack.empty()) break;
+
+                //hand the result up to the rule that used this one:
+                Frame & parent = frame_stack.back();
+                parent.state = summary.exit_state;
+                parent.matches += summary.matches;
+                ++parent.position;
+                continue;
+                }
+
+            code_type code = *top.position;
+            if(FrozenGrammar<Type>::isRule(code))
+                {
+                code_type child = FrozenGrammar<Type>::codeIndex(code);
+                auto child_summary = summaries.find(key(child, top.state));
+                if(child_summary == summaries.end())
+                    {
+                    frame_stack.push_back(Frame{child, top.state, grammar.ruleBegin(child), top.state, 0});
+                    continue;
+                    }
+                top.state = child_summary->second.exit_state;
+                top.matches += child_summary->second.matches;
+                }
+            else
+                {
+                top.state = step(top.state, grammar.value(code));
+                if(top.state == pattern.size()) ++top.matches;
+                }
+            ++top.position;
+            }
+
+        return summaries[key(rule, state)];
+        }
+
+    template<typename Type>
+    std::size_t PatternSearch<Type>::count()
+        {
+        if(pattern.empty() || !grammar.ruleCount()) return 0;
+        return summarise(0, 0).matches;
+        }
+
+    template<typename Type>
+    std::size_t PatternSearch<Type>::find()
+        {
+        std::vector<std::size_t> output = locate(true);
+        return output.empty()? FrozenGrammar<Type>::npos : output.front();
+        }
+
+    template<typename Type>
+    std::vector<std::size_t> PatternSearch<Type>::locate(bool first_only)
+        {
+        std::vector<std::size_t> output;
+        if(pattern.empty() || !count()) return output;
+
+        //positions into each rule body we are inside of:
+        std::vector<std::pair<const code_type*, const code_type*>> position_stack;
+        position_stack.push_back(std::make_pair(grammar.ruleBegin(0), grammar.ruleEnd(0)));
+        unsigned state = 0;
+        std::size_t offset = 0;
+
+        while(!position_stack.empty())
+            {
+            auto & top = position_stack.back();
+            if(top.first == top.second)
+                {
+                position_stack.pop_back();
+                continue;
+                }
+
+            code_type code = *(top.first++);
+            if(FrozenGrammar<Type>::isRule(code))
+                {
+                //step over rules without matches, look inside the rest:
+                code_type rule = FrozenGrammar<Type>::codeIndex(code);
+                const Summary & summary = summarise(rule, state);
+                if(summary.matches)
+                    {
+                    position_stack.push_back(std::make_pair(grammar.ruleBegin(rule), grammar.ruleEnd(rule)));
+                    }
+                else
+                    {
+                    state = summary.exit_state;
+                    offset += grammar.ruleLength(rule);
+                    }
+                }
+            else
+                {
+                state = step(state, grammar.value(code));
+                ++offset;
+                if(state == pattern.size())
+                    {
+                    output.push_back(offset - pattern.size());
+                    if(first_only) break;
+                    }
+                }
+            }
+        return output;
+        }
+
+    //FrozenGrammar searching lives here, now PatternSearch is complete:
+    template<typename Type>
+    std::size_t FrozenGrammar<Type>::find(const std::vector<Type> & pattern) const
+        {
+        return PatternSearch<Type>(*this, pattern).find();
+        }
+
+    template<typename Type>
+    std::vector<std::size_t> FrozenGrammar<Type>::findAll(const std::vector<Type> & pattern) const
+        {
+        return PatternSearch<Type>(*this, pattern).findAll();
+        }
+
+    template<typename Type>
+    std::size_t FrozenGrammar<Type>::countPattern(const std::vector<Type> & pattern) const
+        {
+        return PatternSearch<Type>(*this, pattern).count();
+        }
+
+    }//end jw namespace
+
+#endif // PATTERNSEARCH_HPP
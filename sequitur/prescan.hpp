@@ -0,0 +1,153 @@
+#ifndef PRESCAN_HPP
+#define PRESCAN_HPP
+
+// Hashes for a block of values, worked out in one pass before any of them are
+// added: the hash each ValueSymbol gets, and the DigramIndex hash of each pair
+// of neighbouring values. pushRange() uses these so that each value doesn't
+// have to be hashed as it is added, and so the digram index slot each new
+// digram will probably need can be prefetched a few values ahead.
+//
+// For integer types up to 32 bits, std::hash is (almost always) the value
+// itself, so both passes vectorise: with AVX2 or SSE4.1 enabled at compile
+// time (-mavx2, -msse4.1, -march=native) they use those instructions, and
+// otherwise plain loops. Other types, or a standard library whose std::hash
+// isn't the value, just call std::hash on each value.
+
+#include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+    #include <immintrin.h>
+#endif
+
+#include "digramindex.hpp"
+
+namespace jw
+    {
+    namespace prescan
+        {
+
+        //integers that can be widened into 32 bit lanes as their hash:
+        template<typename Type>
+        struct Widenable: std::integral_constant<bool,
+            std::is_integral<Type>::value && !std::is_same<Type,bool>::value && sizeof(Type) <= 4> {};
+
+        //whether std::hash gives back the value itself, as a ValueSymbol would store it:
+        template<typename Type>
+        bool hashIsValue()
+            {
+            static const bool is_value =
+                unsigned(std::hash<Type>()(Type(0))) == unsigned(Type(0)) &&
+                unsigned(std::hash<Type>()(Type(100))) == unsigned(Type(100)) &&
+                unsigned(std::hash<Type>()(Type(-1))) == unsigned(Type(-1));
+            return is_value;
+            }
+
+        //load values and widen them into 32 bit lanes (sign extending signed types):
+    #if defined(__AVX2__)
+        const std::size_t lanes = 8;
+        inline __m256i widen(const void * in, std::integral_constant<std::size_t,1>, std::true_type)
+            { return _mm256_cvtepi8_epi32(_mm_loadl_epi64(static_cast<const __m128i*>(in))); }
+        inline __m256i widen(const void * in, std::integral_constant<std::size_t,1>, std::false_type)
+            { return _mm256_cvtepu8_epi32(_mm_loadl_epi64(static_cast<const __m128i*>(in))); }
+        inline __m256i widen(const void * in, std::integral_constant<std::size_t,2>, std::true_type)
+            { return _mm256_cvtepi16_epi32(_mm_loadu_si128(static_cast<const __m128i*>(in))); }
+        inline __m256i widen(const void * in, std::integral_constant<std::size_t,2>, std::false_type)
+            { return _mm256_cvtepu16_epi32(_mm_loadu_si128(static_cast<const __m128i*>(in))); }
+        template<typename Signed>
+        inline __m256i widen(const void * in, std::integral_constant<std::size_t,4>, Signed)
+            { return _mm256_loadu_si256(static_cast<const __m256i*>(in)); }
+        inline void store(unsigned int * out, __m256i hashes)
+            { _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), hashes); }
+    #elif defined(__SSE4_1__)
+        const std::size_t lanes = 4;
+        inline __m128i loadWord(const void * in)
+            { int word; std::memcpy(&word, in, sizeof(word)); return _mm_cvtsi32_si128(word); }
+        inline __m128i widen(const void * in, std::integral_constant<std::size_t,1>, std::true_type)
+            { return _mm_cvtepi8_epi32(loadWord(in)); }
+        inline __m128i widen(const void * in, std::integral_constant<std::size_t,1>, std::false_type)
+            { return _mm_cvtepu8_epi32(loadWord(in)); }
+        inline __m128i widen(const void * in, std::integral_constant<std::size_t,2>, std::true_type)
+            { return _mm_cvtepi16_epi32(_mm_loadl_epi64(static_cast<const __m128i*>(in))); }
+        inline __m128i widen(const void * in, std::integral_constant<std::size_t,2>, std::false_type)
+            { return _mm_cvtepu16_epi32(_mm_loadl_epi64(static_cast<const __m128i*>(in))); }
+        template<typename Signed>
+        inline __m128i widen(const void * in, std::integral_constant<std::size_t,4>, Signed)
+            { return _mm_loadu_si128(static_cast<const __m128i*>(in)); }
+        inline void store(unsigned int * out, __m128i hashes)
+            { _mm_storeu_si128(reinterpret_cast<__m128i*>(out), hashes); }
+    #endif
+
+        //hashes of integers are the integers themselves, widened; returns how
+        //many were done this way:
+        template<typename Type>
+        std::size_t widenValues(const Type * values, std::size_t count, unsigned int * hashes, std::true_type)
+            {
+            if(!hashIsValue<Type>()) return 0;
+            std::size_t i = 0;
+        #if defined(__AVX2__) || defined(__SSE4_1__)
+            for(; i + lanes <= count; i += lanes)
+                store(hashes + i, widen(values + i, std::integral_constant<std::size_t,sizeof(Type)>(), std::is_signed<Type>()));
+        #endif
+            for(; i < count; ++i) hashes[i] = unsigned(values[i]);
+            return i;
+            }
+        template<typename Type>
+        std::size_t widenValues(const Type *, std::size_t, unsigned int *, std::false_type)
+            {
+            return 0;
+            }
+
+        //hashes[i] = the hash of values[i], as ValueSymbol<Type> would work it out:
+        template<typename Type>
+        void hashValues(const Type * values, std::size_t count, unsigned int * hashes)
+            {
+            std::size_t i = widenValues(values, count, hashes, Widenable<Type>());
+            for(; i < count; ++i) hashes[i] = std::hash<Type>()(values[i]);
+            }
+
+        //digrams[i] = DigramIndex::hashOf(hashes[i], hashes[i+1]), for the
+        //count-1 digrams in count hashes:
+        inline void hashDigrams(const unsigned int * hashes, std::size_t count, std::uint64_t * digrams)
+            {
+            if(count < 2) return;
+            std::size_t i = 0;
+
+            //64 bit lanes of (first << 32 | second) times the multiplier, made
+            //up from 32 bit multiplies as there's no 64 bit one:
+            const std::uint64_t multiplier = DigramIndex::hash_multiplier;
+        #if defined(__AVX2__)
+            const __m256i low = _mm256_set1_epi64x(multiplier & 0xFFFFFFFF);
+            const __m256i high = _mm256_set1_epi64x(multiplier >> 32);
+            for(; i + 5 <= count; i += 4)
+                {
+                __m256i first = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hashes + i)));
+                __m256i second = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(hashes + i + 1)));
+                __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(first, low), _mm256_mul_epu32(second, high));
+                __m256i result = _mm256_add_epi64(_mm256_mul_epu32(second, low), _mm256_slli_epi64(cross, 32));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(digrams + i), result);
+                }
+        #elif defined(__SSE4_1__)
+            const __m128i low = _mm_set1_epi64x(multiplier & 0xFFFFFFFF);
+            const __m128i high = _mm_set1_epi64x(multiplier >> 32);
+            for(; i + 3 <= count; i += 2)
+                {
+                __m128i first = _mm_cvtepu32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(hashes + i)));
+                __m128i second = _mm_cvtepu32_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(hashes + i + 1)));
+                __m128i cross = _mm_add_epi64(_mm_mul_epu32(first, low), _mm_mul_epu32(second, high));
+                __m128i result = _mm_add_epi64(_mm_mul_epu32(second, low), _mm_slli_epi64(cross, 32));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(digrams + i), result);
+                }
+        #else
+            (void)multiplier;
+        #endif
+            for(; i + 1 < count; ++i) digrams[i] = DigramIndex::hashOf(hashes[i], hashes[i+1]);
+            }
+
+        } //end prescan namespace
+    } //end jw namespace
+
+#endif // PRESCAN_HPP
@@ -0,0 +1,306 @@
+#ifndef REPAIR_HPP
+#define REPAIR_HPP
+
+// Included at the end of sequitur.hpp.
+//
+// RePair<Type> builds a grammar offline, by repeatedly replacing the most
+// frequent digram in the whole input with a new rule until no digram occurs
+// twice (Larsson and Moffat's Re-Pair). That takes all of the input up front
+// and more memory than Sequitur, but usually gives a smaller grammar.
+//
+// The result is handed back as a Sequitur<Type>, so iterating, inspecting,
+// freezing and checkpointing all work just the same whichever built it.
+// Rules Re-Pair leaves used only once are folded into the rule using them, and
+// Sequitur's digram checks are run over the result, so it keeps to the same
+// invariants as a grammar built online.
+//
+// Working state is a handful of flat arrays, indexed by input position:
+// - symbols: the code at each position (values first, then rules).
+// - prev/next: positions still in the sequence, as a linked list.
+// - prev_occurrence/next_occurrence: positions starting the same digram.
+// Digram counts sit in a priority queue; entries are pushed whenever a count
+// changes, and ones that no longer match the count are skipped when popped.
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include <algorithm>
+
+namespace jw
+    {
+
+    template<typename Type>
+    class RePair
+        {
+        public:
+        using value_type = Type;
+
+        //add a value to the end of the input:
+        void push_back(Type value);
+
+        //number of values added so far:
+        unsigned size() const { return sequence.size(); }
+
+        //build the grammar for everything added, and start again empty:
+        Sequitur<Type> build();
+
+        private:
+        using code_type = std::uint32_t;
+        using digram_type = std::uint64_t;
+        static const code_type none = code_type(-1);
+
+        struct DigramRecord
+            {
+            code_type count;
+            code_type first;
+            };
+
+        static digram_type makeDigram(code_type first, code_type second)
+            {
+            return (digram_type(first) << 32) | second;
+            }
+
+        //note the digram starting at position (unless it overlaps the last one):
+        void addOccurrence(code_type position);
+
+        //forget the digram starting at position, if it was noted:
+        void removeOccurrence(code_type position);
+
+        //replace every occurrence of a digram with a new rule:
+        void replaceDigram(digram_type digram);
+
+        //input, as codes into values:
+        std::vector<Type> values;
+        std::unordered_map<Type, code_type> value_codes;
+        std::vector<code_type> sequence;
+
+        //working state while building:
+        std::vector<code_type> symbols;
+        std::vector<code_type> prev;
+        std::vector<code_type> next;
+        std::vector<code_type> prev_occurrence;
+        std::vector<code_type> next_occurrence;
+        std::vector<char> noted;
+        std::unordered_map<digram_type, DigramRecord> digrams;
+        std::priority_queue<std::pair<code_type, digram_type>> counts;
+        std::vector<std::pair<code_type, code_type>> rules;
+        };
+
+    template<typename Type>
+    const typename RePair<Type>::code_type RePair<Type>::none;
+
+    template<typename Type>
+    void RePair<Type>::push_back(Type value)
+        {
+        auto inserted = value_codes.emplace(value, values.size());
+        if(inserted.second) values.push_back(value);
+        sequence.push_back(inserted.first->second);
+        }
+
+    template<typename Type>
+    void RePair<Type>::addOccurrence(code_type position)
+        {
+        code_type after = next[position];
+        if(after == none) return;
+
+        //in a run like "aaa", only every other "aa" can be replaced:
+        code_type before = prev[position];
+        if(symbols[position] == symbols[after] && before != none && noted[before] && symbols[before] == symbols[position])
+            return;
+
+        digram_type digram = makeDigram(symbols[position], symbols[after]);
+        auto inserted = digrams.emplace(digram, DigramRecord{0, none});
+        DigramRecord & record = inserted.first->second;
+
+        next_occurrence[position] = record.first;
+        prev_occurrence[position] = none;
+        if(record.first != none) prev_occurrence[record.first] = position;
+        record.first = position;
+        noted[position] = true;
+
+        counts.emplace(++record.count, digram);
+        }
+
+    template<typename Type>
+    void RePair<Type>::removeOccurrence(code_type position)
+        {
+        if(!noted[position]) return;
+        noted[position] = false;
+
+        auto iter = digrams.find(makeDigram(symbols[position], symbols[next[position]]));
+        DigramRecord & record = iter->second;
+
+        if(prev_occurrence[position] != none) next_occurrence[prev_occurrence[position]] = next_occurrence[position];
+        else record.first = next_occurrence[position];
+        if(next_occurrence[position] != none) prev_occurrence[next_occurrence[position]] = prev_occurrence[position];
+
+        if(!--record.count) digrams.erase(iter);
+        else counts.emplace(record.count, iter->first);
+        }
+
+    template<typename Type>
+    void RePair<Type>::replaceDigram(digram_type digram)
+        {
+        code_type first = digram >> 32;
+        code_type second = digram & 0xFFFFFFFF;
+        code_type rule = values.size() + rules.size();
+        rules.emplace_back(first, second);
+
+        //replacing changes the occurrence list as we go, so copy it out, and go
+        //left to right so runs like "aaaa" are paired up from the start:
+        std::vector<code_type> positions;
+        for(code_type position = digrams.at(digram).first; position != none; position = next_occurrence[position])
+            positions.push_back(position);
+        std::sort(positions.begin(), positions.end());
+
+        for(code_type position : positions)
+            {
+            //an earlier replacement may have used this occurrence up:
+            if(!noted[position] || symbols[position] != first) continue;
+            code_type after = next[position];
+            if(after == none || symbols[after] != second) continue;
+
+            code_type before = prev[position];
+            code_type after_that = next[after];
+
+            if(before != none) removeOccurrence(before);
+            removeOccurrence(position);
+            removeOccurrence(after);
+
+            symbols[position] = rule;
+            next[position] = after_that;
+            if(after_that != none) prev[after_that] = position;
+
+            if(before != none) addOccurrence(before);
+            addOccurrence(position);
+            }
+        }
+
+    template<typename Type>
+    Sequitur<Type> RePair<Type>::build()
+        {
+        const code_type length = sequence.size();
+        symbols = std::move(sequence);
+        sequence = std::vector<code_type>();
+
+        prev.resize(length);
+        next.resize(length);
+        for(code_type position = 0; position < length; ++position)
+            {
+            prev[position] = position? position-1 : none;
+            next[position] = position+1 < length? position+1 : none;
+            }
+        prev_occurrence.assign(length, none);
+        next_occurrence.assign(length, none);
+        noted.assign(length, false);
+
+        for(code_type position = 0; position < length; ++position) addOccurrence(position);
+
+        //replace the most frequent digram until none occur twice:
+        while(!counts.empty())
+            {
+            std::pair<code_type, digram_type> top = counts.top();
+            counts.pop();
+
+            auto iter = digrams.find(top.second);
+            if(iter == digrams.end() || iter->second.count != top.first) continue;
+            if(top.first < 2) break;
+
+            replaceDigram(top.second);
+            }
+
+        //rules used once are folded into whatever uses them:
+        const code_type first_rule = values.size();
+        std::vector<code_type> uses(rules.size(), 0);
+        for(code_type position = 0; position != none && length; position = next[position])
+            {
+            if(symbols[position] >= first_rule) ++uses[symbols[position] - first_rule];
+            }
+        for(const auto & rule : rules)
+            {
+            if(rule.first >= first_rule) ++uses[rule.first - first_rule];
+            if(rule.second >= first_rule) ++uses[rule.second - first_rule];
+            }
+
+        //rule bodies only use earlier rules, so making them in order means each
+        //rule's parts exist by the time it's made:
+        Sequitur<Type> grammar;
+        std::vector<RuleHead*> heads(rules.size(), nullptr);
+        std::vector<code_type> pending;
+
+        auto appendSymbol = [&](RuleHead * rule, ContentHash & content, code_type code)
+            {
+            pending.push_back(code);
+            while(!pending.empty())
+                {
+                code_type current = pending.back();
+                pending.pop_back();
+
+                Symbol * item;
+                if(current < first_rule)
+                    {
+                    item = new typename Sequitur<Type>::Value(values[current]);
+                    }
+                else if(uses[current - first_rule] < 2)
+                    {
+                    pending.push_back(rules[current - first_rule].second);
+                    pending.push_back(rules[current - first_rule].first);
+                    continue;
+                    }
+                else
+                    {
+                    RuleHead * target = heads[current - first_rule];
+                    item = target->makeRuleSymbol().release();
+                    grammar.incrementRule(target);
+                    }
+                rule->getTail()->insertBefore(item);
+                content.append(grammar.symbolContent(item));
+                }
+            };
+
+        for(code_type index = 0; index < rules.size(); ++index)
+            {
+            if(uses[index] < 2) continue;
+
+            RuleTail * rule_tail = new RuleTail();
+            RuleHead * rule_head = new RuleHead(grammar.id_generator.get(), rule_tail);
+            rule_head->insertAfter(rule_tail);
+            grammar.rule_index.insert(rule_head->getID(), rule_head);
+            heads[index] = rule_head;
+
+            ContentHash content;
+            appendSymbol(rule_head, content, rules[index].first);
+            appendSymbol(rule_head, content, rules[index].second);
+            rule_head->setContentHash(content);
+            }
+
+        RuleHead * start_head = static_cast<RuleHead*>(grammar.rule_index.at(0));
+        ContentHash content;
+        for(code_type position = 0; position != none && length; position = next[position])
+            appendSymbol(start_head, content, symbols[position]);
+        start_head->setContentHash(content);
+        grammar.length = length;
+        grammar.rule_index.setDepths(grammar.dictionary_rules + 1);
+
+        //let Sequitur index every digram, tidying up anything left to tidy:
+        std::vector<Symbol*> new_digrams;
+        for(const auto & rule_pair : grammar.rule_index)
+            {
+            RuleHead * rule = static_cast<RuleHead*>(rule_pair.second);
+            for(Symbol * item = rule->next(); typeid(*item) != typeid(RuleTail) && typeid(*(item->next())) != typeid(RuleTail); item = item->next())
+                new_digrams.push_back(item);
+            }
+        for(auto iter = new_digrams.rbegin(); iter != new_digrams.rend(); ++iter) grammar.queueLink(*iter);
+        grammar.processLinks();
+        grammar.inlineShortRules();
+
+        //free the working state, ready for new input:
+        *this = RePair<Type>();
+        return grammar;
+        }
+
+    }//end jw namespace
+
+#endif // REPAIR_HPP
@@ -0,0 +1,166 @@
+#ifndef RULEINDEX_HPP
+#define RULEINDEX_HPP
+
+// Dense index from rule ID to the RuleHead starting that rule. Rule IDs are
+// small and recycled (see ID), so a vector indexed by ID with empty slots for
+// unused IDs beats hashing them. Iterating visits rules in ID order, handing
+// back (ID, Symbol*) pairs just as iterating a map would.
+
+#include <vector>
+#include <utility>
+#include <stdexcept>
+
+#include "symbols.hpp"
+
+namespace jw
+    {
+
+    class RuleIndex
+        {
+        public:
+        using value_type = std::pair<unsigned int, Symbol*>;
+
+        class const_iterator
+            {
+            public:
+            const_iterator(const std::vector<Symbol*> * in_rules, unsigned int position):
+                rules(in_rules), current(position, nullptr)
+                {
+                skipEmpty();
+                }
+
+            const value_type & operator* () const { return current; }
+            const value_type * operator-> () const { return &current; }
+
+            bool operator==(const const_iterator & other) const { return current.first == other.current.first; }
+            bool operator!=(const const_iterator & other) const { return !(*this == other); }
+
+            const_iterator & operator++()
+                {
+                ++current.first;
+                skipEmpty();
+                return *this;
+                }
+            const_iterator operator++(int)
+                {
+                const_iterator tmp(*this);
+                ++(*this);
+                return tmp;
+                }
+
+            private:
+            //move forward to the next slot with a rule in it:
+            void skipEmpty()
+                {
+                while(current.first < rules->size() && !(*rules)[current.first]) ++current.first;
+                current.second = current.first < rules->size()? (*rules)[current.first] : nullptr;
+                }
+
+            const std::vector<Symbol*> * rules;
+            value_type current;
+            };
+
+        RuleIndex() {}
+
+        //moving leaves the other index empty:
+        RuleIndex(RuleIndex && other): rules(std::move(other.rules)), count(other.count)
+            {
+            other.clear();
+            }
+        RuleIndex & operator=(RuleIndex && other)
+            {
+            rules = std::move(other.rules);
+            count = other.count;
+            other.clear();
+            return *this;
+            }
+        RuleIndex(const RuleIndex &)=default;
+        RuleIndex & operator=(const RuleIndex &)=default;
+
+        //return the rule with this ID, throwing if there isn't one:
+        Symbol * at(unsigned int id) const
+            {
+            if(!contains(id)) throw std::out_of_range("RuleIndex: no rule with this ID.");
+            return rules[id];
+            }
+
+        bool contains(unsigned int id) const
+            {
+            return id < rules.size() && rules[id];
+            }
+
+        //add a rule, growing the index if the ID is new:
+        void insert(unsigned int id, Symbol * rule)
+            {
+            if(id >= rules.size()) rules.resize(id+1, nullptr);
+            if(!rules[id]) ++count;
+            rules[id] = rule;
+            }
+
+        void erase(unsigned int id)
+            {
+            if(!contains(id)) return;
+            rules[id] = nullptr;
+            --count;
+            }
+
+        //keeps hold of the memory, for reuse:
+        void clear()
+            {
+            rules.clear();
+            count = 0;
+            }
+
+        unsigned int size() const { return count; }
+        bool empty() const { return !count; }
+
+        //work out the depth of every rule from first_id up from what their bodies
+        //are now: one more than the deepest rule they use (rules below first_id
+        //are taken as they are). Rules are done after the rules they use, with a
+        //stack rather than recursion, as nesting can run deep:
+        void setDepths(unsigned int first_id)
+            {
+            for(unsigned int id = first_id; id < rules.size(); ++id)
+                {
+                if(rules[id]) static_cast<RuleHead*>(rules[id])->setDepth(0);
+                }
+
+            std::vector<RuleHead*> stack;
+            for(unsigned int id = first_id; id < rules.size(); ++id)
+                {
+                if(!rules[id] || static_cast<RuleHead*>(rules[id])->getDepth()) continue;
+                stack.push_back(static_cast<RuleHead*>(rules[id]));
+                while(!stack.empty())
+                    {
+                    RuleHead * rule = stack.back();
+                    unsigned int depth = 1;
+                    bool ready = true;
+                    for(const Symbol * item = rule->next(); item != rule->getTail(); item = item->next())
+                        {
+                        if(typeid(*item) != typeid(RuleSymbol)) continue;
+                        RuleHead * used = static_cast<const RuleSymbol*>(item)->getRule();
+                        if(!used->getDepth())
+                            {
+                            stack.push_back(used);
+                            ready = false;
+                            }
+                        else if(used->getDepth() >= depth) depth = used->getDepth() + 1;
+                        }
+                    if(!ready) continue;
+                    rule->setDepth(depth);
+                    stack.pop_back();
+                    }
+                }
+            }
+
+        const_iterator begin() const { return const_iterator(&rules, 0); }
+        const_iterator end() const { return const_iterator(&rules, rules.size()); }
+
+        private:
+        std::vector<Symbol*> rules;
+        unsigned int count = 0;
+        };
+
+    } //end jw namespace
+
+#endif // RULEINDEX_HPP
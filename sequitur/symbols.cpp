@@ -13,6 +13,11 @@ namespace jw
         return rule_ptr->makeRuleSymbol();
         }
 
+    void RuleSymbol::updateHash()
+        {
+        setHash(std::hash<unsigned>()(getID()));
+        }
+
     //get count of RuleHead through RuleSymbol:
     unsigned int RuleSymbol::getCount() const
         {
@@ -8,6 +8,7 @@
 #include <memory>
 
 #include "id.hpp"
+#include "contenthash.hpp"
 #include "baselist.hpp"
 #include "objectpool.hpp"
 
@@ -29,23 +30,51 @@ namespace jw
         //polymorphic equality check:
         virtual bool isEqual(const Symbol & other) const =0;
 
-        Symbol(): hash_value(0)
+        //bookkeeping flags, used by Sequitur to track symbols waiting in its queues
+        //(and to mark symbols in rule 0 while a rule depth limit is set):
+        enum Flag: unsigned char
+            {
+            QueuedExpansion = 1,
+            QueuedLink = 2,
+            Released = 4,
+            InStart = 8
+            };
+        bool hasFlag(Flag f) const { return flags & f; }
+        void setFlag(Flag f) { flags |= f; }
+        void clearFlag(Flag f) { flags &= ~f; }
+
+        Symbol(): hash_value(0), flags(0)
             {}
-        Symbol(unsigned int hash_val): hash_value(hash_val)
+        Symbol(unsigned int hash_val): hash_value(hash_val), flags(0)
             {}
 
         //virtual destructor so can polymorphically delete:
         virtual ~Symbol()
             {}
 
+        protected:
+        void setHash(unsigned int hash_val)
+            {
+            hash_value = hash_val;
+            }
+
         private:
         unsigned int hash_value;
+        //fits in the padding after hash_value, so costs nothing per symbol:
+        unsigned char flags;
         };
 
 
     //forward declaration of RuleHead for use in RuleSymbol:
     class RuleHead;
 
+    //RuleIndex works out rule depths:
+    class RuleIndex;
+
+    //Sequitur can renumber rules, and it and Dictionary set content hashes:
+    template<typename Type, typename Observer> class Sequitur;
+    template<typename Type> class Dictionary;
+
     //symbol to denote a rule, with a pointer to it:
     class RuleSymbol: public Symbol, UseObjectPool(RuleSymbol)
         {
@@ -71,6 +100,9 @@ namespace jw
         //clone the RuleSymbol:
         std::unique_ptr<Symbol> clone() const;
 
+        //the hash follows the rule ID, so must be updated if that changes:
+        void updateHash();
+
         protected:
         //can't construct element directly:
         //must be made from RuleHead::makeRuleSymbol()
@@ -95,6 +127,11 @@ namespace jw
             Symbol(std::hash<Type>()(val)), value(val)
             {}
 
+        //where the hash has been worked out already (it must be what std::hash gives):
+        ValueSymbol(Type val, unsigned int hash):
+            Symbol(hash), value(val)
+            {}
+
         Type & getValue()
             {
             return value;
@@ -105,6 +142,12 @@ namespace jw
             return value;
             }
 
+        //the std::hash of the value in full; getHash() only keeps the low bits:
+        std::uint64_t getContentHash() const
+            {
+            return std::hash<Type>()(value);
+            }
+
         std::unique_ptr<Symbol> clone() const
             {
             return std::unique_ptr<Symbol>(new ValueSymbol(value));
@@ -140,9 +183,13 @@ namespace jw
         {
         public:
         friend class RuleSymbol;
+        template<typename Type, typename Observer> friend class Sequitur;
+        template<typename Type> friend class Dictionary;
+        template<typename Type> friend class RePair;
+        friend class RuleIndex;
 
         RuleHead(unsigned int id, RuleTail * tail_in):
-            count(0), rule_id(id), tail(tail_in)
+            count(0), rule_id(id), depth(1), tail(tail_in)
             {}
         std::unique_ptr<RuleSymbol> makeRuleSymbol()
             {
@@ -160,6 +207,18 @@ namespace jw
             {
             return tail;
             }
+        //hash (and length) of the sequence this rule expands to:
+        const ContentHash & getContentHash() const
+            {
+            return content;
+            }
+        //how many rules deep this rule nests, itself included, as it was made. Its
+        //body may get deeper afterwards, unless a rule depth limit is set (see
+        //Sequitur::setMaxRuleDepth()):
+        unsigned int getDepth() const
+            {
+            return depth;
+            }
 
         unsigned int increment()
             {
@@ -184,9 +243,25 @@ namespace jw
             }
 
         private:
+        //only Sequitur may renumber rules, as it knows what else needs updating:
+        void setID(unsigned int id)
+            {
+            rule_id = id;
+            }
+        void setContentHash(const ContentHash & in_content)
+            {
+            content = in_content;
+            }
+        void setDepth(unsigned int in_depth)
+            {
+            depth = in_depth;
+            }
+
         unsigned int count;
         unsigned int rule_id;
+        unsigned int depth;
         RuleTail * tail;
+        ContentHash content;
         };
 
 